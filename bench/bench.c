@@ -0,0 +1,257 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // nftw, wait4
+#endif
+
+/*
+ * End-to-end build benchmark: generates a synthetic site (see corpus.h), builds it with sausage a
+ * number of times and prints wall time, pages per second, peak RSS and bytes written as JSON.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/util.h"
+#include "corpus.h"
+
+#ifndef SAUSAGE_BIN
+#define SAUSAGE_BIN "sausage"
+#endif
+#ifndef BENCH_TEMPLATE_DIR
+#define BENCH_TEMPLATE_DIR "templates"
+#endif
+#ifndef BENCH_STATIC_DIR
+#define BENCH_STATIC_DIR "static"
+#endif
+
+#define MAX_RUNS 1000
+
+typedef struct {
+  double wall_ms;
+  long peak_rss_kb;
+  uint64_t pages;
+  uint64_t bytes_written;
+} run_t;
+
+// Totals of the tree nftw is walking, it takes no closure
+static uint64_t g_tree_pages;
+static uint64_t g_tree_bytes;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int remove_entry(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+  (void)statbuf;
+  (void)type;
+  (void)ftw;
+  if (remove(path) != 0) {
+    PANIC_ERRNO("Failed to remove %s", path);
+  }
+  return 0;
+}
+
+static void remove_tree(const char *path) {
+  if (access(path, F_OK) == 0 && nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS) != 0) {
+    PANIC_ERRNO("Failed to remove %s", path);
+  }
+}
+
+static int measure_entry(const char *path, const struct stat *statbuf, int type,
+                         struct FTW *ftw) {
+  (void)ftw;
+  if (type == FTW_F) {
+    size_t length = strlen(path);
+    g_tree_bytes += statbuf->st_size;
+    g_tree_pages += (length > 5 && strcmp(path + length - 5, ".html") == 0) ||
+                    (length > 4 && strcmp(path + length - 4, ".xml") == 0);
+  }
+  return 0;
+}
+
+static run_t run_build(const char *sausage, const char *dir, uint32_t jobs) {
+  char jobs_arg[16];
+  snprintf(jobs_arg, sizeof(jobs_arg), "%u", jobs);
+  char *argv[] = {(char *)sausage, "--wasm", "wasm", "--jobs", jobs_arg, NULL};
+
+  double start = now_ms();
+  pid_t pid = fork();
+  if (pid < 0) {
+    PANIC_ERRNO("Failed to fork");
+  } else if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (chdir(dir) != 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0) {
+      PANIC_ERRNO("Failed to set up the build in %s", dir);
+    }
+    execvp(sausage, argv);
+    PANIC_ERRNO("Failed to run %s", sausage);
+  }
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) {
+    PANIC_ERRNO("Failed to wait for %s", sausage);
+  }
+  run_t run = {.wall_ms = now_ms() - start, .peak_rss_kb = usage.ru_maxrss};
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    PANIC("Build of %s failed with status %d", dir, status);
+  }
+
+  char public[MAX_PATH_LEN];
+  int s = snprintf(public, MAX_PATH_LEN, "%s/public", dir);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct output path in %s", dir);
+  }
+  g_tree_pages = g_tree_bytes = 0;
+  if (nftw(public, measure_entry, 64, FTW_PHYS) != 0) {
+    PANIC_ERRNO("Failed to walk %s", public);
+  }
+  run.pages = g_tree_pages;
+  run.bytes_written = g_tree_bytes;
+  return run;
+}
+
+static void clean(const char *dir, bool cache) {
+  char path[MAX_PATH_LEN];
+  int s = snprintf(path, MAX_PATH_LEN, "%s/public", dir);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct output path in %s", dir);
+  }
+  remove_tree(path);
+  if (cache) {
+    snprintf(path, MAX_PATH_LEN, "%s/.cache", dir);
+    remove_tree(path);
+  }
+}
+
+static int wall_cmp(const void *a, const void *b) {
+  double x = ((const run_t *)a)->wall_ms, y = ((const run_t *)b)->wall_ms;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static unsigned long parse_number(const char *flag, const char *value, unsigned long max) {
+  if (value == NULL) {
+    PANIC("No value for %s given", flag);
+  }
+  char *end;
+  unsigned long n = strtoul(value, &end, 10);
+  if (*end != '\0' || n > max) {
+    PANIC("Invalid value for %s: %s", flag, value);
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  corpus_t corpus = {
+      .num_posts = 1000,
+      .num_tags = 100,
+      .paragraphs = 8,
+      .code_blocks = 2,
+      .tag_skew = 1.1,
+      .seed = 1,
+  };
+  uint32_t runs = 5;
+  long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t jobs = nproc > 0 ? nproc : 1;
+  const char *sausage = SAUSAGE_BIN;
+  const char *template_dir = BENCH_TEMPLATE_DIR;
+  const char *static_dir = BENCH_STATIC_DIR;
+  const char *dir = "bench-site";
+  bool warm = false;
+  bool keep = false;
+  for (int i = 1; i < argc; ++i) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp("--posts", argv[i]) == 0) {
+      corpus.num_posts = parse_number(argv[i], value, UINT32_MAX);
+    } else if (strcmp("--tags", argv[i]) == 0) {
+      corpus.num_tags = parse_number(argv[i], value, UINT32_MAX);
+    } else if (strcmp("--paragraphs", argv[i]) == 0) {
+      corpus.paragraphs = parse_number(argv[i], value, 10000);
+    } else if (strcmp("--code-blocks", argv[i]) == 0) {
+      corpus.code_blocks = parse_number(argv[i], value, 10000);
+    } else if (strcmp("--skew", argv[i]) == 0) {
+      corpus.tag_skew = value != NULL ? strtod(value, NULL) : 0;
+      if (corpus.tag_skew <= 0) {
+        PANIC("Invalid value for --skew");
+      }
+    } else if (strcmp("--seed", argv[i]) == 0) {
+      corpus.seed = parse_number(argv[i], value, ULONG_MAX);
+    } else if (strcmp("--runs", argv[i]) == 0) {
+      runs = parse_number(argv[i], value, MAX_RUNS);
+    } else if (strcmp("--jobs", argv[i]) == 0 || strcmp("-j", argv[i]) == 0) {
+      jobs = parse_number(argv[i], value, UINT32_MAX);
+    } else if (strcmp("--sausage", argv[i]) == 0) {
+      sausage = value;
+    } else if (strcmp("--templates", argv[i]) == 0) {
+      template_dir = value;
+    } else if (strcmp("--static", argv[i]) == 0) {
+      static_dir = value;
+    } else if (strcmp("--dir", argv[i]) == 0) {
+      dir = value;
+    } else if (strcmp("--warm", argv[i]) == 0) {
+      warm = true;
+      continue;
+    } else if (strcmp("--keep", argv[i]) == 0) {
+      keep = true;
+      continue;
+    } else {
+      PANIC("Unknown argument %s", argv[i]);
+    }
+    if (value == NULL || runs == 0 || jobs == 0) {
+      PANIC("Invalid value for %s", argv[i]);
+    }
+    ++i;
+  }
+
+  fprintf(stderr, "generating %u posts with %u tags in %s\n", corpus.num_posts, corpus.num_tags,
+          dir);
+  remove_tree(dir);
+  corpus_generate(&corpus, dir, template_dir, static_dir);
+  if (warm) {
+    // an untimed build fills the content cache
+    clean(dir, true);
+    run_build(sausage, dir, jobs);
+  }
+
+  run_t results[MAX_RUNS];
+  for (uint32_t i = 0; i < runs; ++i) {
+    clean(dir, !warm);
+    results[i] = run_build(sausage, dir, jobs);
+    fprintf(stderr, "run %u: %.1f ms\n", i + 1, results[i].wall_ms);
+  }
+
+  printf("{\n  \"posts\": %u,\n  \"tags\": %u,\n  \"seed\": %llu,\n  \"jobs\": %u,\n"
+         "  \"cache\": \"%s\",\n  \"runs\": [\n",
+         corpus.num_posts, corpus.num_tags, (unsigned long long)corpus.seed, jobs,
+         warm ? "warm" : "cold");
+  long peak_rss_kb = 0;
+  for (uint32_t i = 0; i < runs; ++i) {
+    printf("    {\"wall_ms\": %.3f, \"pages\": %llu, \"pages_per_sec\": %.1f, "
+           "\"peak_rss_kb\": %ld, \"bytes_written\": %llu}%s\n",
+           results[i].wall_ms, (unsigned long long)results[i].pages,
+           results[i].pages / (results[i].wall_ms / 1e3), results[i].peak_rss_kb,
+           (unsigned long long)results[i].bytes_written, i + 1 < runs ? "," : "");
+    peak_rss_kb = results[i].peak_rss_kb > peak_rss_kb ? results[i].peak_rss_kb : peak_rss_kb;
+  }
+  qsort(results, runs, sizeof(run_t), wall_cmp);
+  const run_t *median = &results[runs / 2];
+  printf("  ],\n  \"wall_ms\": {\"min\": %.3f, \"median\": %.3f, \"max\": %.3f},\n"
+         "  \"pages\": %llu,\n  \"pages_per_sec\": %.1f,\n  \"peak_rss_kb\": %ld,\n"
+         "  \"bytes_written\": %llu\n}\n",
+         results[0].wall_ms, median->wall_ms, results[runs - 1].wall_ms,
+         (unsigned long long)median->pages, median->pages / (median->wall_ms / 1e3), peak_rss_kb,
+         (unsigned long long)median->bytes_written);
+
+  if (!keep) {
+    remove_tree(dir);
+  }
+  return 0;
+}
@@ -0,0 +1,351 @@
+#include "corpus.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../src/util.h"
+
+#define MAX_TAGS_PER_POST 5
+
+typedef struct {
+  uint64_t state;
+} rng_t;
+
+static const char *g_words[] = {
+    "sausage", "build",   "static",  "site",   "render",  "template", "thread",   "cache",
+    "parser",  "grammar", "syntax",  "memory", "buffer",  "latency",  "pointer",  "kernel",
+    "vector",  "branch",  "layout",  "output", "escape",  "token",    "compiler", "linker",
+    "lorem",   "ipsum",   "dolor",   "sit",    "amet",    "quick",    "brown",    "fox",
+    "the",     "a",       "of",      "and",    "to",      "in",       "is",       "with",
+    "for",     "on",      "that",    "it",     "as",      "from",     "by",       "this",
+};
+
+static const char *g_c_types[] = {"int", "size_t", "uint32_t", "char *", "double", "bool"};
+static const char *g_rust_types[] = {"i32", "usize", "u32", "&str", "f64", "bool"};
+
+// xorshift64*
+static uint64_t rng_next(rng_t *rng) {
+  rng->state ^= rng->state >> 12;
+  rng->state ^= rng->state << 25;
+  rng->state ^= rng->state >> 27;
+  return rng->state * 0x2545f4914f6cdd1d;
+}
+
+static uint32_t rng_below(rng_t *rng, uint32_t n) { return n ? rng_next(rng) % n : 0; }
+
+// Around mean, between half and one and a half of it
+static uint32_t rng_around(rng_t *rng, uint32_t mean) {
+  return mean / 2 + rng_below(rng, mean + 1);
+}
+
+static const char *word(rng_t *rng) { return g_words[rng_below(rng, arrlen(g_words))]; }
+
+static FILE *open_file(const char *dir, const char *name) {
+  char path[MAX_PATH_LEN];
+  int s = snprintf(path, MAX_PATH_LEN, "%s/%s", dir, name);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct path for %s", name);
+  }
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  return fp;
+}
+
+static void make_dir(const char *path) {
+  if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+    PANIC_ERRNO("Failed to make directory %s", path);
+  }
+}
+
+static void copy_tree(const char *from, const char *to) {
+  DIR *dirp = opendir(from);
+  if (dirp == NULL) {
+    PANIC_ERRNO("Failed to open directory %s", from);
+  }
+  make_dir(to);
+  struct dirent *ep;
+  while ((ep = readdir(dirp)) != NULL) {
+    if (strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0) {
+      continue;
+    }
+    char from_path[MAX_PATH_LEN], to_path[MAX_PATH_LEN];
+    int s = snprintf(from_path, MAX_PATH_LEN, "%s/%s", from, ep->d_name);
+    int t = snprintf(to_path, MAX_PATH_LEN, "%s/%s", to, ep->d_name);
+    if (s < 0 || s >= MAX_PATH_LEN || t < 0 || t >= MAX_PATH_LEN) {
+      PANIC("Failed to construct path for %s", ep->d_name);
+    }
+    struct stat statbuf;
+    if (stat(from_path, &statbuf) != 0) {
+      PANIC_ERRNO("Failed to stat %s", from_path);
+    }
+    if (S_ISDIR(statbuf.st_mode)) {
+      copy_tree(from_path, to_path);
+    } else if (S_ISREG(statbuf.st_mode)) {
+      file_view_t contents = map_file(from_path);
+      FILE *fp = fopen(to_path, "w");
+      if (fp == NULL || fwrite(contents.data, 1, contents.length, fp) != contents.length ||
+          fclose(fp) != 0) {
+        PANIC_ERRNO("Failed to write %s", to_path);
+      }
+      unmap_file(&contents);
+    }
+  }
+  closedir(dirp);
+}
+
+static void write_words(FILE *fp, rng_t *rng, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    fputs(i ? " " : "", fp);
+    switch (rng_below(rng, 40)) {
+    case 0:
+      fprintf(fp, "*%s*", word(rng));
+      break;
+    case 1:
+      fprintf(fp, "**%s**", word(rng));
+      break;
+    case 2:
+      fprintf(fp, "`%s_%s()`", word(rng), word(rng));
+      break;
+    case 3:
+      fprintf(fp, "[%s](https://example.com/%s)", word(rng), word(rng));
+      break;
+    case 4:
+      fprintf(fp, "%s & %s", word(rng), word(rng));
+      break;
+    case 5:
+      fprintf(fp, "\"%s\" < %s", word(rng), word(rng));
+      break;
+    default:
+      fputs(word(rng), fp);
+    }
+  }
+}
+
+static void write_c_code(FILE *fp, rng_t *rng) {
+  fputs("#include <stdio.h>\n\n", fp);
+  uint32_t functions = 1 + rng_below(rng, 4);
+  for (uint32_t f = 0; f < functions; ++f) {
+    const char *type = g_c_types[rng_below(rng, arrlen(g_c_types))];
+    fprintf(fp, "// %s the %s\n", word(rng), word(rng));
+    fprintf(fp, "static %s %s_%s(const char *s, size_t n) {\n", type, word(rng), word(rng));
+    fprintf(fp, "  %s acc = 0;\n", type);
+    uint32_t lines = 2 + rng_below(rng, 8);
+    for (uint32_t l = 0; l < lines; ++l) {
+      switch (rng_below(rng, 4)) {
+      case 0:
+        fprintf(fp, "  for (size_t i = 0; i < n; ++i) {\n    acc += s[i] * %u;\n  }\n",
+                rng_below(rng, 100));
+        break;
+      case 1:
+        fprintf(fp, "  if (n > %u && s[0] == '<') {\n    printf(\"%s: %%zu\\n\", n);\n  }\n",
+                rng_below(rng, 1000), word(rng));
+        break;
+      case 2:
+        fprintf(fp, "  /* %s %s */\n  acc ^= (acc << %u) | 0x%x;\n", word(rng), word(rng),
+                rng_below(rng, 31), rng_below(rng, 0xffff));
+        break;
+      default:
+        fprintf(fp, "  while (n-- > 0 && acc != %u) {\n    acc = acc * 31 + *s++;\n  }\n",
+                rng_below(rng, 7));
+      }
+    }
+    fputs("  return acc;\n}\n\n", fp);
+  }
+}
+
+static void write_rust_code(FILE *fp, rng_t *rng) {
+  fputs("use std::collections::HashMap;\n\n", fp);
+  uint32_t functions = 1 + rng_below(rng, 4);
+  for (uint32_t f = 0; f < functions; ++f) {
+    const char *type = g_rust_types[rng_below(rng, arrlen(g_rust_types))];
+    fprintf(fp, "/// %s the %s\n", word(rng), word(rng));
+    fprintf(fp, "pub fn %s_%s(items: &[%s]) -> usize {\n", word(rng), word(rng), type);
+    fputs("    let mut seen: HashMap<String, usize> = HashMap::new();\n", fp);
+    uint32_t lines = 2 + rng_below(rng, 8);
+    for (uint32_t l = 0; l < lines; ++l) {
+      switch (rng_below(rng, 3)) {
+      case 0:
+        fprintf(fp, "    for (i, item) in items.iter().enumerate() {\n"
+                    "        *seen.entry(format!(\"{:?}\", item)).or_insert(0) += i * %u;\n"
+                    "    }\n",
+                rng_below(rng, 100));
+        break;
+      case 1:
+        fprintf(fp, "    if items.len() > %u {\n        println!(\"%s: {}\", items.len());\n    }\n",
+                rng_below(rng, 1000), word(rng));
+        break;
+      default:
+        fprintf(fp, "    // %s %s\n    let _%s = items.len() << %u;\n", word(rng), word(rng),
+                word(rng), rng_below(rng, 31));
+      }
+    }
+    fputs("    seen.len()\n}\n\n", fp);
+  }
+}
+
+static void write_post(FILE *fp, const corpus_t *corpus, rng_t *rng) {
+  uint32_t paragraphs = rng_around(rng, corpus->paragraphs);
+  uint32_t code_blocks = rng_around(rng, corpus->code_blocks);
+  for (uint32_t p = 0; p < paragraphs + code_blocks; ++p) {
+    // code blocks spread among the paragraphs
+    if (rng_below(rng, paragraphs + code_blocks - p) < code_blocks) {
+      --code_blocks;
+      bool c = rng_below(rng, 2);
+      fputs(c ? "```c\n" : "```rust\n", fp);
+      c ? write_c_code(fp, rng) : write_rust_code(fp, rng);
+      fputs("```\n\n", fp);
+      continue;
+    }
+    switch (rng_below(rng, 8)) {
+    case 0:
+      fputs("## ", fp);
+      write_words(fp, rng, 2 + rng_below(rng, 5));
+      fputs("\n\n", fp);
+      break;
+    case 1:
+      for (uint32_t i = 0, n = 2 + rng_below(rng, 5); i < n; ++i) {
+        fputs("- ", fp);
+        write_words(fp, rng, 3 + rng_below(rng, 10));
+        fputs("\n", fp);
+      }
+      fputs("\n", fp);
+      break;
+    case 2:
+      fputs("> ", fp);
+      write_words(fp, rng, 10 + rng_below(rng, 30));
+      fputs("\n\n", fp);
+      break;
+    default:
+      write_words(fp, rng, 40 + rng_below(rng, 80));
+      fputs("\n\n", fp);
+    }
+  }
+}
+
+// Picks a tag by binary search in the cumulative Zipf weights
+static uint32_t pick_tag(rng_t *rng, const double *cdf, uint32_t num_tags) {
+  double x = (rng_next(rng) >> 11) * 0x1.0p-53 * cdf[num_tags - 1];
+  uint32_t lo = 0, hi = num_tags - 1;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (cdf[mid] < x) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void write_toml(FILE *toml, const corpus_t *corpus, rng_t *rng) {
+  double *cdf = malloc_panic((corpus->num_tags + 1) * sizeof(double));
+  for (uint32_t i = 0; i < corpus->num_tags; ++i) {
+    cdf[i] = (i ? cdf[i - 1] : 0) + 1 / pow(i + 1, corpus->tag_skew);
+  }
+
+  fputs("site_name = \"Benchmark site\"\n"
+        "site_url = \"https://example.com\"\n"
+        "site_desc = \"Generated for benchmarks\"\n\n"
+        "pages = [ \"index\", \"about\", \"blog\" ]\n",
+        toml);
+  time_t day = 946684800; // 2000-01-01
+  for (uint32_t i = 0; i < corpus->num_posts; ++i) {
+    const char *first = word(rng), *second = word(rng);
+    fprintf(toml, "\n[post.p%u]\ntitle = \"%s %s %u\"\n", i, first, second, i);
+    fprintf(toml, "desc = \"A post about %s\"\n", word(rng));
+
+    uint32_t tags[MAX_TAGS_PER_POST];
+    uint32_t num_tags = corpus->num_tags ? 1 + rng_below(rng, MAX_TAGS_PER_POST) : 0;
+    num_tags = num_tags > corpus->num_tags ? corpus->num_tags : num_tags;
+    for (uint32_t t = 0; t < num_tags; ++t) {
+      bool duplicate;
+      do {
+        tags[t] = pick_tag(rng, cdf, corpus->num_tags);
+        duplicate = false;
+        for (uint32_t u = 0; u < t; ++u) {
+          duplicate |= tags[u] == tags[t];
+        }
+      } while (duplicate);
+    }
+    fputs("tags = [", toml);
+    for (uint32_t t = 0; t < num_tags; ++t) {
+      fprintf(toml, "%s\"t%u\"", t ? ", " : " ", tags[t]);
+    }
+    fputs(" ]\n", toml);
+
+    day += 86400 * (1 + rng_below(rng, 3));
+    struct tm tm;
+    gmtime_r(&day, &tm);
+    fprintf(toml, "date = %04d-%02d-%02d\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+  }
+  free(cdf);
+}
+
+char *corpus_toml(const corpus_t *corpus, size_t *length) {
+  rng_t rng = {.state = corpus->seed ? corpus->seed : 1};
+  char *data;
+  FILE *fp = open_memstream(&data, length);
+  if (fp == NULL) {
+    PANIC_ERRNO("Failed to open memory stream");
+  }
+  write_toml(fp, corpus, &rng);
+  fclose(fp);
+  return data;
+}
+
+char *corpus_code(const char *language, size_t size, uint64_t seed, size_t *length) {
+  rng_t rng = {.state = seed ? seed : 1};
+  bool c = strcmp(language, "c") == 0;
+  if (!c && strcmp(language, "rust") != 0) {
+    PANIC("No code generator for %s", language);
+  }
+  char *data;
+  FILE *fp = open_memstream(&data, length);
+  if (fp == NULL) {
+    PANIC_ERRNO("Failed to open memory stream");
+  }
+  while (ftell(fp) < (long)size) {
+    c ? write_c_code(fp, &rng) : write_rust_code(fp, &rng);
+  }
+  fclose(fp);
+  return data;
+}
+
+void corpus_generate(const corpus_t *corpus, const char *dir, const char *template_dir,
+                     const char *static_dir) {
+  char path[MAX_PATH_LEN];
+  make_dir(dir);
+  int s = snprintf(path, MAX_PATH_LEN, "%s/templates", dir);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct path in %s", dir);
+  }
+  copy_tree(template_dir, path);
+  snprintf(path, MAX_PATH_LEN, "%s/static", dir);
+  copy_tree(static_dir, path);
+  snprintf(path, MAX_PATH_LEN, "%s/wasm", dir);
+  make_dir(path);
+  snprintf(path, MAX_PATH_LEN, "%s/posts", dir);
+  make_dir(path);
+
+  rng_t rng = {.state = corpus->seed ? corpus->seed : 1};
+  FILE *toml = open_file(dir, "sausage.toml");
+  write_toml(toml, corpus, &rng);
+  if (fclose(toml) != 0) {
+    PANIC_ERRNO("Failed to write sausage.toml");
+  }
+  for (uint32_t i = 0; i < corpus->num_posts; ++i) {
+    char name[64];
+    snprintf(name, sizeof(name), "posts/p%u.md", i);
+    FILE *md = open_file(dir, name);
+    write_post(md, corpus, &rng);
+    if (fclose(md) != 0) {
+      PANIC_ERRNO("Failed to write post %u", i);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef _SSG_BENCH_CORPUS_H_
+#define _SSG_BENCH_CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Synthetic site for benchmarks: num_posts posts of Markdown with headings, lists, quotes, inline
+ * markup, characters that need escaping and fenced C and Rust code (the grammars in TS_GRAMMARS),
+ * tagged from num_tags tags with a Zipf distribution, so a few tags are on most posts and most
+ * tags on a few. Deterministic for a given seed.
+ */
+
+typedef struct {
+  uint32_t num_posts;
+  uint32_t num_tags;
+  uint32_t paragraphs;  // per post, on average
+  uint32_t code_blocks; // per post, on average
+  double tag_skew;      // Zipf exponent
+  uint64_t seed;
+} corpus_t;
+
+// sausage.toml alone, as a malloc'd string
+extern char *corpus_toml(const corpus_t *corpus, size_t *length);
+// At least size bytes of C or Rust like the code blocks in posts, as a malloc'd string
+extern char *corpus_code(const char *language, size_t size, uint64_t seed, size_t *length);
+// Writes the site into dir, with templates and static files copied from template_dir and static_dir
+extern void corpus_generate(const corpus_t *corpus, const char *dir, const char *template_dir,
+                            const char *static_dir);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * Microbenchmarks of the hot kernels, linked against the sausage sources so they measure the very
+ * code the build runs. Each case repeats one operation until --min-time has passed and reports
+ * ns per operation, ns per input byte and heap allocations per operation as JSON lines.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/cache.h"
+#include "../src/hescape/hescape.h"
+#include "../src/meta.h"
+#include "../src/mustach/mustach.h"
+#include "../src/tmpl.h"
+#include "../src/util.h"
+#include "corpus.h"
+
+#ifndef BENCH_TEMPLATE_DIR
+#define BENCH_TEMPLATE_DIR "templates"
+#endif
+
+/*
+ * Every heap allocation of the process goes through these, so the counter covers the libraries
+ * too (cmark, toml, tree-sitter). glibc exports its own implementations under __libc_*.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_size_t g_allocs;
+
+void *malloc(size_t size) {
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+typedef void (*op_t)(void *arg);
+
+static double g_min_time_ms = 200;
+static const char *g_kernel = NULL; // only run this kernel
+static bool g_first = true;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool wanted(const char *kernel) { return g_kernel == NULL || strcmp(g_kernel, kernel) == 0; }
+
+static void measure(const char *kernel, const char *input, size_t bytes, op_t op, void *arg) {
+  op(arg); // warm up caches, lazily built tables and thread-local buffers
+  uint64_t iterations = 0;
+  size_t allocs = atomic_load(&g_allocs);
+  double start = now_ns(), elapsed;
+  // batches keep the clock out of the measurement for the fast kernels
+  for (uint64_t batch = 1;; batch = batch < 1024 ? batch * 2 : batch) {
+    for (uint64_t i = 0; i < batch; ++i) {
+      op(arg);
+    }
+    iterations += batch;
+    elapsed = now_ns() - start;
+    if (elapsed >= g_min_time_ms * 1e6) {
+      break;
+    }
+  }
+  allocs = atomic_load(&g_allocs) - allocs;
+  double ns_per_op = elapsed / iterations;
+  printf("%s  {\"kernel\": \"%s\", \"input\": \"%s\", \"bytes\": %zu, \"iterations\": %llu, "
+         "\"ns_per_op\": %.1f, \"ns_per_byte\": %.4f, \"allocs_per_op\": %.2f}",
+         g_first ? "" : ",\n", kernel, input, bytes, (unsigned long long)iterations, ns_per_op,
+         bytes > 0 ? ns_per_op / bytes : 0, (double)allocs / iterations);
+  fflush(stdout);
+  g_first = false;
+}
+
+// Prose in which about one byte in every 1/density needs escaping, deterministic
+static char *escape_input(size_t size, double density) {
+  static const char plain[] = "the quick brown fox jumps over the lazy dog ";
+  static const char special[] = "<>&\"'";
+  char *data = malloc_panic(size + 1);
+  uint64_t state = 0x9e3779b97f4a7c15;
+  for (size_t i = 0; i < size; ++i) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    double r = (double)((state * 0x2545f4914f6cdd1d) >> 11) / (double)(1ull << 53);
+    data[i] = r < density ? special[i % (sizeof(special) - 1)] : plain[i % (sizeof(plain) - 1)];
+  }
+  data[size] = '\0';
+  return data;
+}
+
+typedef struct {
+  const char *data;
+  size_t length;
+} text_t;
+
+static void escape_op(void *arg) {
+  text_t *text = arg;
+  uint8_t *escaped;
+  hesc_escape_html(&escaped, (const uint8_t *)text->data, text->length);
+  if (escaped != (const uint8_t *)text->data) {
+    free(escaped);
+  }
+}
+
+static int emit_get(void *closure, const char *name, struct mustach_sbuf *sbuf) {
+  (void)name;
+  text_t *text = closure;
+  sbuf->value = text->data;
+  sbuf->length = text->length;
+  return MUSTACH_OK;
+}
+
+// The emit template has no sections, but mustach insists on the whole interface
+static int emit_enter(void *closure, const char *name) {
+  (void)closure;
+  (void)name;
+  return 0;
+}
+
+static int emit_next(void *closure) {
+  (void)closure;
+  return 0;
+}
+
+static int emit_leave(void *closure) {
+  (void)closure;
+  return 0;
+}
+
+static const struct mustach_itf g_emit_itf = {
+    .enter = emit_enter, .next = emit_next, .leave = emit_leave, .get = emit_get};
+
+// mustach_mem without an emit callback goes through iwrap_emit into a memory stream
+static void emit_op(void *arg) {
+  char *result;
+  size_t size;
+  if (mustach_mem("{{value}}", 0, &g_emit_itf, arg, Mustach_With_NoExtensions, &result, &size) <
+      0) {
+    PANIC("Failed to render the emit template");
+  }
+  free(result);
+}
+
+static void bench_escape(void) {
+  static const double densities[] = {0, 0.01, 0.1, 0.5};
+  const size_t size = 64 * 1024;
+  for (size_t i = 0; i < arrlen(densities); ++i) {
+    text_t text = {.data = escape_input(size, densities[i]), .length = size};
+    char input[32];
+    snprintf(input, sizeof(input), "64K, %g%% escaped", densities[i] * 100);
+    if (wanted("escape")) {
+      measure("escape", input, size, escape_op, &text);
+    }
+    if (wanted("emit")) {
+      measure("emit", input, size, emit_op, &text);
+    }
+    free((char *)text.data);
+  }
+}
+
+typedef struct {
+  const char *language;
+  text_t code;
+  strbuf_t out;
+} highlight_arg_t;
+
+static void highlight_op(void *arg) {
+  highlight_arg_t *hl = arg;
+  strbuf_reset(&hl->out);
+  if (!highlight_block(&hl->out, hl->language, hl->code.data, hl->code.length)) {
+    PANIC("No grammar for %s", hl->language);
+  }
+}
+
+static void bench_highlight(void) {
+  static const char *languages[] = {"c", "rust"};
+  static const size_t sizes[] = {1024, 16 * 1024, 256 * 1024, 1024 * 1024};
+  for (size_t i = 0; i < arrlen(languages); ++i) {
+    for (size_t j = 0; j < arrlen(sizes); ++j) {
+      highlight_arg_t hl = {.language = languages[i]};
+      hl.code.data = corpus_code(languages[i], sizes[j], 1, &hl.code.length);
+      char input[32];
+      snprintf(input, sizeof(input), "%s, %zuK", languages[i], sizes[j] / 1024);
+      measure("highlight", input, hl.code.length, highlight_op, &hl);
+      strbuf_free(&hl.out);
+      free((char *)hl.code.data);
+    }
+  }
+}
+
+static void meta_op(void *arg) { meta_free(meta_render(arg)); }
+
+static void bench_meta(void) {
+  static const uint32_t posts[] = {1000, 10000, 100000};
+  for (size_t i = 0; i < arrlen(posts); ++i) {
+    corpus_t corpus = {
+        .num_posts = posts[i], .num_tags = posts[i] / 10, .tag_skew = 1.1, .seed = 1};
+    size_t length;
+    char *toml = corpus_toml(&corpus, &length);
+    char errbuf[256];
+    toml_table_t *table = toml_parse(toml, errbuf, sizeof(errbuf));
+    if (table == NULL) {
+      PANIC("Failed to parse the generated sausage.toml: %s", errbuf);
+    }
+    char input[32];
+    snprintf(input, sizeof(input), "%u posts", posts[i]);
+    measure("meta", input, length, meta_op, table);
+    toml_free(table);
+    free(toml);
+  }
+}
+
+typedef struct {
+  closure_t closure;
+  const template_t *tmpl;
+} render_arg_t;
+
+static void render_op(void *arg) {
+  render_arg_t *render = arg;
+  size_t length;
+  free(render_string(&render->closure, render->tmpl, &length));
+}
+
+// Renders the listing and a post page, with the post content in place so no Markdown is involved
+static void bench_render(const char *template_dir) {
+  corpus_t corpus = {.num_posts = 1000, .num_tags = 100, .tag_skew = 1.1, .seed = 1};
+  size_t length;
+  char *toml = corpus_toml(&corpus, &length);
+  char errbuf[256];
+  toml_table_t *table = toml_parse(toml, errbuf, sizeof(errbuf));
+  if (table == NULL) {
+    PANIC("Failed to parse the generated sausage.toml: %s", errbuf);
+  }
+  meta_t *meta = meta_render(table);
+  toml_free(table);
+  free(toml);
+  for (uint32_t i = 0; i < meta->num_posts; ++i) {
+    meta->posts[i].content = escape_input(8 * 1024, 0); // stands in for rendered Markdown
+  }
+  templates_load(template_dir);
+  templates_check(meta);
+
+  static const struct {
+    const char *name;
+    closure_state_e state;
+  } pages[] = {{"index", ROOT}, {"blog", ROOT}, {"post", POST}, {"tag", TAG}};
+  for (size_t i = 0; i < arrlen(pages); ++i) {
+    render_arg_t render = {
+        .closure = {.meta = meta, .state = pages[i].state},
+        .tmpl = template_get(pages[i].name),
+    };
+    if (render.tmpl == NULL) {
+      continue;
+    }
+    char *page = render_string(&render.closure, render.tmpl, &length);
+    free(page);
+    measure("render", pages[i].name, length, render_op, &render);
+    strbuf_free(&render.closure.out);
+  }
+  templates_free();
+  meta_free(meta);
+}
+
+int main(int argc, char **argv) {
+  const char *template_dir = BENCH_TEMPLATE_DIR;
+  for (int i = 1; i < argc; ++i) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp("--min-time", argv[i]) == 0) {
+      g_min_time_ms = value != NULL ? strtod(value, NULL) : 0;
+    } else if (strcmp("--kernel", argv[i]) == 0) {
+      g_kernel = value;
+    } else if (strcmp("--templates", argv[i]) == 0) {
+      template_dir = value;
+    } else {
+      PANIC("Unknown argument %s", argv[i]);
+    }
+    if (value == NULL || g_min_time_ms <= 0) {
+      PANIC("Invalid value for %s", argv[i]);
+    }
+    ++i;
+  }
+  cache_init(NULL); // highlighting and rendering are measured, not the cache
+
+  printf("[\n");
+  if (wanted("escape") || wanted("emit")) {
+    bench_escape();
+  }
+  if (wanted("highlight")) {
+    bench_highlight();
+  }
+  if (wanted("meta")) {
+    bench_meta();
+  }
+  if (wanted("render")) {
+    bench_render(template_dir);
+  }
+  printf("\n]\n");
+  return 0;
+}
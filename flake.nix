@@ -13,6 +13,9 @@
         let
           clangenv = pkgs.keepDebugInfo pkgs.clangStdenv;
           wasmenv = pkgs.pkgsCross.wasi32.llvmPackages_16.stdenv;
+          ts-langs = (pkgs.tree-sitter.withPlugins (p: map (lang: p.${"tree-sitter-" + lang})
+            [ "c" "rust" ]
+          ));
         in
         rec {
           devShells.default = pkgs.mkShell.override { stdenv = clangenv; } {
@@ -40,9 +43,6 @@
                   cp *.wasm $out
                 '';
               });
-              ts-langs = (pkgs.tree-sitter.withPlugins (p: map (lang: p.${"tree-sitter-" + lang})
-                [ "c" "rust" ]
-              ));
             in
             clangenv.mkDerivation
               rec {
@@ -54,19 +54,21 @@
                   tomlc99
                   tree-sitter
                   ts-langs
+                  zlib
+                  zstd
                 ];
 
                 buildPhase =
                   let
                     sources = builtins.concatStringsSep " "
-                      [ "main.c" "meta.c" "tmpl.c" "util.c" "mustach/mustach.c" "hescape/hescape.c" ];
+                      [ "main.c" "build.c" "watch.c" "serve.c" "arena.c" "sync.c" "meta.c" "tmpl.c" "util.c" "pool.c" "cache.c" "asset.c" "compress.c" "minify.c" "prof.c" "output.c" "mustach/mustach.c" "hescape/hescape.c" ];
                     includes = builtins.concatStringsSep " "
                       (map (l: "-I${lib.getDev l}/include") buildInputs);
                     ldpath = builtins.concatStringsSep " "
                       (map (l: "-L${lib.getLib l}") buildInputs);
                   in
                   ''
-                    cc -Wall -Werror -Wpedantic -o ${name} ${sources} ${ts-langs}/*.so ${includes} ${ldpath} -lcmark -ltoml -ltree-sitter
+                    cc -Wall -Werror -Wpedantic -DHAVE_ZSTD -o ${name} ${sources} ${ts-langs}/*.so ${includes} ${ldpath} -lcmark -ltoml -ltree-sitter -lz -lzstd -pthread
                   '';
 
                 installPhase = ''
@@ -76,6 +78,68 @@
                   cp ${name} $out/bin/
                 '';
               };
+          # nix build .#bench && ./result/bin/sausage-bench --posts 5000 > bench.json
+          packages.bench = clangenv.mkDerivation {
+            name = "sausage-bench";
+            src = ./.;
+            buildPhase = ''
+              cc -O2 -Wall -Werror -Wpedantic -o sausage-bench bench/bench.c bench/corpus.c src/util.c -lm \
+                -DSAUSAGE_BIN='"${packages.default}/bin/sausage"' \
+                -DBENCH_TEMPLATE_DIR='"${./templates}"' \
+                -DBENCH_STATIC_DIR='"${./static}"'
+            '';
+            installPhase = ''
+              mkdir -p $out/bin
+              cp sausage-bench $out/bin/
+            '';
+          };
+          # nix build .#micro && ./result/bin/sausage-micro > micro.json
+          packages.micro = clangenv.mkDerivation rec {
+            name = "sausage-micro";
+            src = ./.;
+            buildInputs = packages.default.buildInputs;
+            buildPhase =
+              let
+                # everything but the entry point, the build driver and the file watching and serving
+                sources = builtins.concatStringsSep " " (map (f: "src/" + f)
+                  [ "tmpl.c" "meta.c" "arena.c" "util.c" "pool.c" "cache.c" "asset.c" "compress.c" "minify.c" "prof.c" "output.c" "mustach/mustach.c" "hescape/hescape.c" ]);
+                includes = builtins.concatStringsSep " "
+                  (map (l: "-I${lib.getDev l}/include") buildInputs);
+                ldpath = builtins.concatStringsSep " "
+                  (map (l: "-L${lib.getLib l}") buildInputs);
+              in
+              ''
+                cc -O2 -Wall -Werror -Wpedantic -DHAVE_ZSTD -o ${name} bench/micro.c bench/corpus.c ${sources} ${ts-langs}/*.so ${includes} ${ldpath} -lcmark -ltoml -ltree-sitter -lz -lzstd -lm -pthread \
+                  -DBENCH_TEMPLATE_DIR='"${./templates}"'
+              '';
+            installPhase = ''
+              mkdir -p $out/bin
+              cp ${name} $out/bin/
+            '';
+          };
+          # nix flake check
+          checks.default = clangenv.mkDerivation rec {
+            name = "sausage-test";
+            src = ./.;
+            buildInputs = packages.default.buildInputs;
+            buildPhase =
+              let
+                sources = builtins.concatStringsSep " " (map (f: "src/" + f)
+                  [ "tmpl.c" "meta.c" "arena.c" "util.c" "pool.c" "cache.c" "asset.c" "compress.c" "minify.c" "prof.c" "output.c" "mustach/mustach.c" "hescape/hescape.c" ]);
+                includes = builtins.concatStringsSep " "
+                  (map (l: "-I${lib.getDev l}/include") buildInputs);
+                ldpath = builtins.concatStringsSep " "
+                  (map (l: "-L${lib.getLib l}") buildInputs);
+              in
+              ''
+                cc -Wall -Werror -Wpedantic -DHAVE_ZSTD -o ${name} test/test.c ${sources} ${ts-langs}/*.so ${includes} ${ldpath} -lcmark -ltoml -ltree-sitter -lz -lzstd -lm -pthread \
+                  -DTEST_TEMPLATE_DIR='"${./templates}"'
+                ./${name}
+              '';
+            installPhase = ''
+              touch $out
+            '';
+          };
         };
     };
 }
@@ -0,0 +1,38 @@
+-- Serves the .zst or .gz sibling written by `sausage --compress` when the client accepts it
+local r = lighty.r
+local path = r.req_attr["physical.path"]
+if not path then
+  return 0
+end
+
+local types = {
+  html = "text/html; charset=utf-8",
+  xml = "application/xml; charset=utf-8",
+  css = "text/css; charset=utf-8",
+  js = "text/javascript; charset=utf-8",
+  mjs = "text/javascript; charset=utf-8",
+  json = "application/json",
+  svg = "image/svg+xml",
+  txt = "text/plain; charset=utf-8",
+  wasm = "application/wasm",
+  map = "application/json",
+}
+local content_type = types[path:match("%.(%w+)$") or ""]
+if not content_type then
+  return 0
+end
+
+r.resp_header["Vary"] = "Accept-Encoding"
+local accept = r.req_header["Accept-Encoding"] or ""
+for _, encoding in ipairs({ { "zstd", ".zst" }, { "gzip", ".gz" } }) do
+  if accept:find(encoding[1], 1, true) then
+    local st = lighty.c.stat(path .. encoding[2])
+    if st and st.is_file then
+      r.req_attr["physical.path"] = path .. encoding[2]
+      r.resp_header["Content-Encoding"] = encoding[1]
+      r.resp_header["Content-Type"] = content_type
+      return 0
+    end
+  end
+end
+return 0
@@ -0,0 +1,93 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <string.h>
+
+#include "util.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_chunk {
+  arena_chunk_t *prev;
+  size_t used;
+  size_t size;
+  alignas(max_align_t) char data[];
+};
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  arena_chunk_t *chunk = arena->chunk;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    chunk = malloc_panic(sizeof(arena_chunk_t) + chunk_size);
+    chunk->prev = arena->chunk;
+    chunk->used = 0;
+    chunk->size = chunk_size;
+    arena->chunk = chunk;
+  }
+  void *p = chunk->data + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+void *arena_calloc(arena_t *arena, size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    PANIC("Arena allocation overflow: %zu * %zu", count, size);
+  }
+  void *p = arena_alloc(arena, count * size);
+  memset(p, 0, count * size);
+  return p;
+}
+
+char *arena_strdup(arena_t *arena, const char *str) {
+  size_t length = strlen(str);
+  char *copy = arena_alloc(arena, length + 1);
+  memcpy(copy, str, length + 1);
+  return copy;
+}
+
+static char **intern_slot(char **table, size_t capacity, const char *str, size_t length) {
+  size_t mask = capacity - 1;
+  for (size_t i = hash_bytes(str, length) & mask;; i = (i + 1) & mask) {
+    if (table[i] == NULL || strcmp(table[i], str) == 0) {
+      return &table[i];
+    }
+  }
+}
+
+char *arena_intern(arena_t *arena, const char *str) {
+  if (2 * (arena->num_interned + 1) > arena->interned_capacity) {
+    size_t capacity = arena->interned_capacity ? 2 * arena->interned_capacity : 64;
+    char **table = calloc(capacity, sizeof(char *));
+    if (table == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    for (size_t i = 0; i < arena->interned_capacity; ++i) {
+      char *old = arena->interned[i];
+      if (old != NULL) {
+        *intern_slot(table, capacity, old, strlen(old)) = old;
+      }
+    }
+    free(arena->interned);
+    arena->interned = table;
+    arena->interned_capacity = capacity;
+  }
+  char **slot = intern_slot(arena->interned, arena->interned_capacity, str, strlen(str));
+  if (*slot == NULL) {
+    *slot = arena_strdup(arena, str);
+    ++arena->num_interned;
+  }
+  return *slot;
+}
+
+void arena_free(arena_t *arena) {
+  arena_chunk_t *chunk = arena->chunk;
+  while (chunk != NULL) {
+    arena_chunk_t *prev = chunk->prev;
+    free(chunk);
+    chunk = prev;
+  }
+  free(arena->interned);
+  *arena = (arena_t){0};
+}
@@ -0,0 +1,29 @@
+#ifndef _SSG_ARENA_H_
+#define _SSG_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocator. Allocations live until arena_free, which releases them all at once by freeing
+ * the chunks they were carved from. Not thread-safe.
+ */
+
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+  arena_chunk_t *chunk; // current chunk, linked to the ones before it
+  char **interned;      // open addressing table of interned strings
+  size_t num_interned;
+  size_t interned_capacity;
+} arena_t;
+
+extern void *arena_alloc(arena_t *arena, size_t size);
+// Zeroed array of count elements
+extern void *arena_calloc(arena_t *arena, size_t count, size_t size);
+extern char *arena_strdup(arena_t *arena, const char *str);
+// Returns the arena's copy of str, so equal strings share one copy and compare by pointer
+extern char *arena_intern(arena_t *arena, const char *str);
+extern void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,267 @@
+#include "asset.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "compress.h"
+#include "output.h"
+#include "util.h"
+
+#define ASSET_XATTR "user.sausage.fingerprint"
+#define ASSET_HASH_LEN 10
+
+typedef struct {
+  char *logical;
+  char *url;
+} asset_t;
+
+// Filled in by the copy jobs, read-only while pages render
+typedef struct {
+  pthread_mutex_t lock;
+  asset_t *slots; // open addressing, logical is NULL if empty
+  size_t num_assets;
+  size_t mask;
+} asset_map_t;
+
+// The hash of a file, valid while its modification time and size match
+typedef struct {
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t size;
+  uint64_t hash;
+} asset_hash_t;
+
+static bool g_assets_enabled = false;
+static asset_map_t g_assets = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static const char *g_asset_exts[] = {
+    ".css", ".js",  ".mjs",  ".wasm", ".png", ".jpg", ".jpeg", ".gif",
+    ".webp", ".avif", ".svg", ".woff", ".woff2", ".ttf", ".otf",
+};
+
+void assets_init(bool enabled) { g_assets_enabled = enabled; }
+
+bool assets_enabled(void) { return g_assets_enabled; }
+
+bool asset_wanted(const char *path) {
+  const char *ext = strrchr(path, '.');
+  if (ext == NULL || strchr(ext, '/') != NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < arrlen(g_asset_exts); ++i) {
+    if (strcmp(ext, g_asset_exts[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static asset_t *asset_slot(asset_t *slots, size_t mask, const char *logical) {
+  for (size_t i = hash_bytes(logical, strlen(logical)) & mask;; i = (i + 1) & mask) {
+    if (slots[i].logical == NULL || strcmp(slots[i].logical, logical) == 0) {
+      return &slots[i];
+    }
+  }
+}
+
+// Rehashes into a table twice the size, which is kept at most half full
+static void assets_grow(void) {
+  size_t capacity = g_assets.mask ? 2 * (g_assets.mask + 1) : 64;
+  asset_t *slots = calloc(capacity, sizeof(asset_t));
+  if (slots == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+  for (size_t i = 0; g_assets.mask && i <= g_assets.mask; ++i) {
+    if (g_assets.slots[i].logical != NULL) {
+      *asset_slot(slots, capacity - 1, g_assets.slots[i].logical) = g_assets.slots[i];
+    }
+  }
+  free(g_assets.slots);
+  g_assets.slots = slots;
+  g_assets.mask = capacity - 1;
+}
+
+static char *copy_string(const char *str) {
+  size_t length = strlen(str);
+  char *copy = malloc_panic(length + 1);
+  memcpy(copy, str, length + 1);
+  return copy;
+}
+
+// Removes the fingerprinted copy at url and its compressed siblings
+static void remove_copy(const char *url) {
+  char path[MAX_PATH_LEN];
+  int s = snprintf(path, MAX_PATH_LEN, OUTPUT_DIR "%s", url);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    return;
+  }
+  unlink(path);
+  compress_remove(path);
+}
+
+static bool assets_put(const char *logical, const char *url) {
+  pthread_mutex_lock(&g_assets.lock);
+  if (2 * (g_assets.num_assets + 1) > g_assets.mask + 1) {
+    assets_grow();
+  }
+  asset_t *slot = asset_slot(g_assets.slots, g_assets.mask, logical);
+  bool changed = slot->logical == NULL || strcmp(slot->url, url) != 0;
+  if (slot->logical == NULL) {
+    slot->logical = copy_string(logical);
+    ++g_assets.num_assets;
+  }
+  if (changed) {
+    // the old copy stays cached under its URL, but no page links it any more
+    if (slot->url != NULL) {
+      remove_copy(slot->url);
+      free(slot->url);
+    }
+    slot->url = copy_string(url);
+  }
+  pthread_mutex_unlock(&g_assets.lock);
+  return changed;
+}
+
+// Hashes the file, or takes the hash stored on it if the file has not changed since
+static uint64_t asset_hash(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat statbuf;
+  if (fd < 0 || fstat(fd, &statbuf) != 0) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  asset_hash_t stored;
+  if (fgetxattr(fd, ASSET_XATTR, &stored, sizeof(stored)) == sizeof(stored) &&
+      stored.mtime_sec == statbuf.st_mtim.tv_sec && stored.mtime_nsec == statbuf.st_mtim.tv_nsec &&
+      stored.size == statbuf.st_size) {
+    close(fd);
+    return stored.hash;
+  }
+  asset_hash_t computed = {
+      .mtime_sec = statbuf.st_mtim.tv_sec,
+      .mtime_nsec = statbuf.st_mtim.tv_nsec,
+      .size = statbuf.st_size,
+      .hash = hash_bytes("", 0),
+  };
+  if (statbuf.st_size > 0) {
+    void *data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      PANIC_ERRNO("Failed to map %s", path);
+    }
+    computed.hash = hash_bytes(data, statbuf.st_size);
+    munmap(data, statbuf.st_size);
+  }
+  // without xattr support the file is simply hashed again next time
+  fsetxattr(fd, ASSET_XATTR, &computed, sizeof(computed), 0);
+  close(fd);
+  return computed.hash;
+}
+
+bool asset_fingerprint(const char *path, char fingerprinted[MAX_PATH_LEN]) {
+  uint64_t hash = asset_hash(path);
+  const char *base = strrchr(path, '/');
+  base = base != NULL ? base + 1 : path;
+  const char *ext = strrchr(base, '.');
+  if (ext == NULL || ext == base) {
+    ext = base + strlen(base);
+  }
+  int s = snprintf(fingerprinted, MAX_PATH_LEN, "%.*s.%0*llx%s", (int)(ext - path), path,
+                   ASSET_HASH_LEN, (unsigned long long)(hash >> (64 - 4 * ASSET_HASH_LEN)), ext);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct fingerprinted path for %s", path);
+  }
+  size_t prefix = strlen(OUTPUT_DIR);
+  if (strncmp(path, OUTPUT_DIR "/", prefix + 1) != 0) {
+    PANIC("Asset %s is not in " OUTPUT_DIR, path);
+  }
+  return assets_put(path + prefix, fingerprinted + prefix);
+}
+
+bool asset_remove(const char *path) {
+  size_t prefix = strlen(OUTPUT_DIR);
+  if (g_assets.mask == 0 || strncmp(path, OUTPUT_DIR "/", prefix + 1) != 0) {
+    return false;
+  }
+  pthread_mutex_lock(&g_assets.lock);
+  asset_t *slot = asset_slot(g_assets.slots, g_assets.mask, path + prefix);
+  bool found = slot->logical != NULL;
+  if (found) {
+    remove_copy(slot->url);
+    free(slot->logical);
+    free(slot->url);
+    *slot = (asset_t){0};
+    --g_assets.num_assets;
+    // the entries after it in its run may have probed past it, so they go in again
+    size_t i = slot - g_assets.slots;
+    for (size_t j = (i + 1) & g_assets.mask; g_assets.slots[j].logical != NULL;
+         j = (j + 1) & g_assets.mask) {
+      asset_t moved = g_assets.slots[j];
+      g_assets.slots[j] = (asset_t){0};
+      *asset_slot(g_assets.slots, g_assets.mask, moved.logical) = moved;
+    }
+  }
+  pthread_mutex_unlock(&g_assets.lock);
+  return found;
+}
+
+const char *asset_url(const char *logical) {
+  if (g_assets.mask == 0) {
+    return logical;
+  }
+  const asset_t *slot = asset_slot(g_assets.slots, g_assets.mask, logical);
+  return slot->logical != NULL ? slot->url : logical;
+}
+
+static int asset_cmp(const void *a, const void *b) {
+  return strcmp(((const asset_t *)a)->logical, ((const asset_t *)b)->logical);
+}
+
+void assets_write_manifest(const char *path) {
+  // sorted, so that an unchanged site gives an unchanged manifest
+  asset_t *assets = malloc_panic((g_assets.num_assets + 1) * sizeof(asset_t));
+  size_t num_assets = 0;
+  for (size_t i = 0; g_assets.mask && i <= g_assets.mask; ++i) {
+    if (g_assets.slots[i].logical != NULL) {
+      assets[num_assets++] = g_assets.slots[i];
+    }
+  }
+  qsort(assets, num_assets, sizeof(asset_t), asset_cmp);
+
+  // written only if it changed, like the pages
+  char *json;
+  size_t length;
+  FILE *fp = open_memstream(&json, &length);
+  if (fp == NULL) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  fputs("{\n", fp);
+  for (size_t i = 0; i < num_assets; ++i) {
+    fputs("  ", fp);
+    write_json_string(fp, assets[i].logical);
+    fputs(": ", fp);
+    write_json_string(fp, assets[i].url);
+    fputs(i + 1 < num_assets ? ",\n" : "\n", fp);
+  }
+  fputs("}\n", fp);
+  if (fclose(fp) != 0) {
+    PANIC_ERRNO("Failed to write %s", path);
+  }
+  write_if_changed(path, json, length);
+  free(json);
+  free(assets);
+}
+
+void assets_free(void) {
+  for (size_t i = 0; g_assets.mask && i <= g_assets.mask; ++i) {
+    free(g_assets.slots[i].logical);
+    free(g_assets.slots[i].url);
+  }
+  free(g_assets.slots);
+  g_assets.slots = NULL;
+  g_assets.num_assets = 0;
+  g_assets.mask = 0;
+}
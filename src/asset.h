@@ -0,0 +1,32 @@
+#ifndef _SSG_ASSET_H_
+#define _SSG_ASSET_H_
+
+#include <stdbool.h>
+
+#include "conf.h"
+
+/*
+ * Fingerprinted static assets. Each CSS, JS, font or image copied from STATIC_DIR also gets a copy
+ * named after its content, style.css next to style.3fa9c1d2e4.css, which can be cached forever.
+ * Templates look the URLs up with {{asset:/style.css}}, the build writes the whole map to
+ * ASSET_MANIFEST for the server config and for deploy tooling.
+ *
+ * Without fingerprinting, asset_url hands back the logical URL.
+ */
+
+extern void assets_init(bool enabled);
+extern bool assets_enabled(void);
+// Whether path has a type worth fingerprinting
+extern bool asset_wanted(const char *path);
+// Names the fingerprinted copy of path, which is under OUTPUT_DIR, and records its URL. Returns
+// whether the URL changed. Safe to call from several threads.
+extern bool asset_fingerprint(const char *path, char fingerprinted[MAX_PATH_LEN]);
+// Forgets path, which was removed from OUTPUT_DIR, and removes its fingerprinted copy. Returns
+// whether it had one.
+extern bool asset_remove(const char *path);
+// The URL to link for the logical URL of a file in STATIC_DIR, such as /style.css
+extern const char *asset_url(const char *logical);
+extern void assets_write_manifest(const char *path);
+extern void assets_free(void);
+
+#endif
@@ -0,0 +1,224 @@
+#include "build.h"
+
+#include <string.h>
+
+#include "asset.h"
+#include "conf.h"
+#include "output.h"
+#include "prof.h"
+#include "sync.h"
+#include "util.h"
+
+static void render_job(void *arg, uint32_t worker);
+
+build_t *build_new(uint32_t num_workers, char *wasmdir) {
+  build_t *build = malloc_panic(sizeof(build_t));
+  *build = (build_t){.wasmdir = wasmdir, .pool = pool_new(num_workers)};
+  build->closures = calloc(num_workers, sizeof(closure_t));
+  if (build->closures == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+  return build;
+}
+
+void build_load_meta(build_t *build) {
+  printf("PARSING METADATA FILE " METADATA_FILE "\n");
+  meta_t *meta = meta_parse(METADATA_FILE);
+  meta_debug(meta);
+  if (build->meta != NULL) {
+    meta_free(build->meta);
+  }
+  build->meta = meta;
+  for (uint32_t i = 0; i < pool_num_workers(build->pool); ++i) {
+    closure_t *closure = &build->closures[i];
+    closure->meta = meta;
+    closure->state = ROOT;
+    closure->index = 0;
+    closure->index_inner = 0;
+  }
+  free(build->post_queued);
+  free(build->tag_queued);
+  build->post_queued = calloc(meta->num_posts + 1, sizeof(bool));
+  build->tag_queued = calloc(meta->num_tags + 1, sizeof(bool));
+  if (build->post_queued == NULL || build->tag_queued == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+  build->num_jobs = 0;
+  build->listings_queued = false;
+  build->all_queued = false;
+}
+
+void build_setup_output(build_t *build) {
+  printf("SETTING UP OUTPUT DIRECTORY " OUTPUT_DIR "\n");
+  make_output_dir(OUTPUT_DIR);
+  make_output_dir(OUTPUT_DIR "/post");
+  make_output_dir(OUTPUT_DIR "/scripts");
+  make_output_dir(OUTPUT_DIR "/scripts/post");
+  make_output_dir(OUTPUT_DIR "/tag");
+  make_output_dir(OUTPUT_DIR "/wasm");
+
+  // recursive, so this covers static/scripts and static/scripts/post as well
+  outputs_begin_assets();
+  copy_files(build->pool, STATIC_DIR, OUTPUT_DIR, true);
+  // scripts fetch wasm by name, so it keeps its name
+  copy_files(build->pool, build->wasmdir, OUTPUT_DIR "/wasm", false);
+  if (assets_enabled()) {
+    assets_write_manifest(ASSET_MANIFEST);
+  }
+}
+
+static void queue_job(build_t *build, job_t job) {
+  if (build->num_jobs == build->max_jobs) {
+    build->max_jobs = build->max_jobs ? 2 * build->max_jobs : 64;
+    build->jobs = realloc(build->jobs, build->max_jobs * sizeof(job_t));
+    if (build->jobs == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+  }
+  build->jobs[build->num_jobs++] = job;
+}
+
+void build_queue_listings(build_t *build) {
+  if (build->listings_queued) {
+    return;
+  }
+  build->listings_queued = true;
+  meta_t *meta = build->meta;
+  for (uint32_t i = 0; i < meta->num_pages; ++i) {
+    const template_t *tmpl = template_get(meta->pages[i]);
+    uint32_t num_pages = listing_num_pages(tmpl, meta, meta->num_posts);
+    for (uint32_t page = num_pages > 0; page <= num_pages; ++page) {
+      queue_job(build, (job_t){.tmpl = tmpl,
+                               .name = meta->pages[i],
+                               .ext = "html",
+                               .state = ROOT,
+                               .page = page,
+                               .num_pages = num_pages});
+    }
+  }
+  queue_job(build, (job_t){.tmpl = template_get("rss"),
+                           .name = "rss",
+                           .ext = "xml",
+                           .state = ROOT});
+}
+
+void build_queue_post(build_t *build, uint32_t post_handle) {
+  if (build->post_queued[post_handle]) {
+    return;
+  }
+  build->post_queued[post_handle] = true;
+  queue_job(build, (job_t){.tmpl = template_get("post"),
+                           .ext = "html",
+                           .state = POST,
+                           .index = post_handle});
+}
+
+void build_queue_tag(build_t *build, uint32_t tag_handle) {
+  if (build->tag_queued[tag_handle]) {
+    return;
+  }
+  build->tag_queued[tag_handle] = true;
+  const template_t *tmpl = template_get("tag");
+  uint32_t num_pages =
+      listing_num_pages(tmpl, build->meta, build->meta->tags[tag_handle].num_posts);
+  for (uint32_t page = num_pages > 0; page <= num_pages; ++page) {
+    queue_job(build, (job_t){.tmpl = tmpl,
+                             .ext = "html",
+                             .state = TAG,
+                             .index = tag_handle,
+                             .page = page,
+                             .num_pages = num_pages});
+  }
+}
+
+void build_queue_all(build_t *build) {
+  build->all_queued = true;
+  build_queue_listings(build);
+  for (uint32_t i = 0; i < build->meta->num_posts; ++i) {
+    build_queue_post(build, i);
+  }
+  for (uint32_t i = 0; i < build->meta->num_tags; ++i) {
+    build_queue_tag(build, i);
+  }
+}
+
+typedef struct {
+  build_t *build;
+  job_t *job;
+} job_arg_t;
+
+static void render_job(void *arg, uint32_t worker) {
+  job_arg_t *job_arg = arg;
+  job_t *job = job_arg->job;
+  closure_t *closure = &job_arg->build->closures[worker];
+  closure->state = job->state;
+  closure->index = job->index;
+  closure->index_inner = 0;
+  closure->listing = job->state;
+  closure->page = job->page;
+  closure->num_pages = job->num_pages;
+
+  char base[256];
+  switch (job->state) {
+  case POST:
+    snprintf(base, sizeof(base), "post/%s", closure->meta->posts[job->index].slug);
+    break;
+  case TAG:
+    snprintf(base, sizeof(base), "tag/%s", closure->meta->tags[job->index].id);
+    break;
+  default:
+    snprintf(base, sizeof(base), "%s", job->name);
+    break;
+  }
+  closure->listing_slug = base;
+  // page 1 keeps the listing's URL, the others go in a directory named after it
+  char slug[256 + 16];
+  if (job->page > 1) {
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), OUTPUT_DIR "/%s", base);
+    make_output_dir(dir);
+    snprintf(slug, sizeof(slug), "%s/%u", base, job->page);
+  } else {
+    snprintf(slug, sizeof(slug), "%s", base);
+  }
+  printf("  " OUTPUT_DIR "/%s\n", slug);
+  render_file(closure, job->tmpl, slug, job->ext);
+}
+
+size_t build_run(build_t *build) {
+  size_t num_jobs = build->num_jobs;
+  uint64_t start = prof_begin();
+  outputs_begin(build->all_queued);
+  job_arg_t *args = malloc_panic(num_jobs * sizeof(job_arg_t));
+  for (size_t i = 0; i < num_jobs; ++i) {
+    args[i] = (job_arg_t){.build = build, .job = &build->jobs[i]};
+    pool_submit(build->pool, render_job, &args[i]);
+  }
+  pool_wait(build->pool);
+  free(args);
+  prof_end("build", "render", start);
+
+  outputs_finish(OUTPUT_MANIFEST);
+
+  build->num_jobs = 0;
+  build->listings_queued = false;
+  build->all_queued = false;
+  memset(build->post_queued, 0, build->meta->num_posts * sizeof(bool));
+  memset(build->tag_queued, 0, build->meta->num_tags * sizeof(bool));
+  return num_jobs;
+}
+
+void build_free(build_t *build) {
+  for (uint32_t i = 0; i < pool_num_workers(build->pool); ++i) {
+    strbuf_free(&build->closures[i].out);
+  }
+  pool_free(build->pool);
+  if (build->meta != NULL) {
+    meta_free(build->meta);
+  }
+  free(build->post_queued);
+  free(build->tag_queued);
+  free(build->jobs);
+  free(build->closures);
+  free(build);
+}
@@ -0,0 +1,49 @@
+#ifndef _SSG_BUILD_H_
+#define _SSG_BUILD_H_
+
+#include <stdbool.h>
+
+#include "meta.h"
+#include "pool.h"
+#include "tmpl.h"
+
+typedef struct {
+  const template_t *tmpl;
+  char *name;
+  char *ext;
+  closure_state_e state;
+  uint32_t index;
+  uint32_t page; // of num_pages of a paginated listing, 0 if it is not paginated
+  uint32_t num_pages;
+} job_t;
+
+/*
+ * State that outlives a single build: the parsed metadata, the worker pool with one closure per
+ * worker, and the render jobs queued for the next run. Templates live in the template store.
+ */
+typedef struct {
+  meta_t *meta;
+  char *wasmdir;
+  pool_t *pool;
+  closure_t *closures; // one per worker
+  job_t *jobs;
+  size_t num_jobs;
+  size_t max_jobs;
+  bool *post_queued; // dedupes jobs within a run
+  bool *tag_queued;
+  bool listings_queued;
+  bool all_queued; // every output is rendered, so stale ones can be pruned
+} build_t;
+
+extern build_t *build_new(uint32_t num_workers, char *wasmdir);
+extern void build_load_meta(build_t *build);
+extern void build_setup_output(build_t *build);
+extern void build_queue_listings(build_t *build);
+extern void build_queue_post(build_t *build, uint32_t post_handle);
+extern void build_queue_tag(build_t *build, uint32_t tag_handle);
+extern void build_queue_all(build_t *build);
+// Renders every queued job on the pool, returns the number of rendered outputs
+extern size_t build_run(build_t *build);
+extern void build_free(build_t *build);
+
+#endif
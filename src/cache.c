@@ -0,0 +1,481 @@
+#include "cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CODE_CACHE_FILE "code.bin"
+#define CODE_CACHE_MAGIC "SSGCODE1"
+#define CODE_CACHE_MAX_AGE 16            // builds an entry may go unused before eviction
+#define CODE_CACHE_MAX_BYTES (64 << 20) // highlighted HTML kept across builds
+
+static char g_cache_dir[MAX_PATH_LEN];
+
+static bool make_dir(const char *path) { return mkdir(path, 0777) == 0 || errno == EEXIST; }
+
+void cache_init(const char *dir) {
+  if (dir == NULL) {
+    g_cache_dir[0] = '\0';
+    return;
+  }
+  int s = snprintf(g_cache_dir, sizeof(g_cache_dir), "%s", dir);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct cache path: length exceeded");
+  }
+  if (!make_dir(g_cache_dir)) {
+    printf("Disabling cache: failed to make directory %s: %s\n", g_cache_dir, strerror(errno));
+    g_cache_dir[0] = '\0';
+  }
+}
+
+bool cache_enabled(void) { return g_cache_dir[0] != '\0'; }
+
+// Entries read or written since cache_sweep_begin(), by the hash of their kind and key
+static struct {
+  pthread_mutex_t lock;
+  uint64_t *slots; // open addressing, 0 if empty
+  size_t num_used;
+  size_t mask;
+} g_used = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t used_key(const char *kind, uint64_t key) {
+  uint64_t hash = hash_update(hash_bytes(kind, strlen(kind)), &key, sizeof(key));
+  return hash == 0 ? 1 : hash;
+}
+
+static size_t used_slot(uint64_t *slots, size_t mask, uint64_t hash) {
+  size_t slot = hash & mask;
+  while (slots[slot] != 0 && slots[slot] != hash) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static void mark_used(const char *kind, uint64_t key) {
+  uint64_t hash = used_key(kind, key);
+  pthread_mutex_lock(&g_used.lock);
+  if (2 * (g_used.num_used + 1) > g_used.mask + 1) {
+    size_t capacity = g_used.mask ? 2 * (g_used.mask + 1) : 1024;
+    uint64_t *slots = calloc(capacity, sizeof(uint64_t));
+    if (slots == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    for (size_t i = 0; g_used.mask && i <= g_used.mask; ++i) {
+      if (g_used.slots[i] != 0) {
+        slots[used_slot(slots, capacity - 1, g_used.slots[i])] = g_used.slots[i];
+      }
+    }
+    free(g_used.slots);
+    g_used.slots = slots;
+    g_used.mask = capacity - 1;
+  }
+  size_t slot = used_slot(g_used.slots, g_used.mask, hash);
+  if (g_used.slots[slot] == 0) {
+    g_used.slots[slot] = hash;
+    ++g_used.num_used;
+  }
+  pthread_mutex_unlock(&g_used.lock);
+}
+
+static bool was_used(const char *kind, uint64_t key) {
+  uint64_t hash = used_key(kind, key);
+  return g_used.mask && g_used.slots[used_slot(g_used.slots, g_used.mask, hash)] == hash;
+}
+
+void cache_sweep_begin(void) {
+  pthread_mutex_lock(&g_used.lock);
+  free(g_used.slots);
+  g_used.slots = NULL;
+  g_used.num_used = 0;
+  g_used.mask = 0;
+  pthread_mutex_unlock(&g_used.lock);
+}
+
+void cache_sweep(const char *kind) {
+  char dir[MAX_PATH_LEN];
+  int s = snprintf(dir, sizeof(dir), "%s/%s", g_cache_dir, kind);
+  DIR *dirp = cache_enabled() && s >= 0 && s < MAX_PATH_LEN ? opendir(dir) : NULL;
+  if (dirp == NULL) {
+    return;
+  }
+  size_t removed = 0;
+  struct dirent *ep;
+  while ((ep = readdir(dirp)) != NULL) {
+    // only whole entries, never the temporary file of a put in progress
+    char *end;
+    unsigned long long key = strtoull(ep->d_name, &end, 16);
+    if (strlen(ep->d_name) != 16 || *end != '\0' || was_used(kind, key)) {
+      continue;
+    }
+    char path[MAX_PATH_LEN];
+    s = snprintf(path, sizeof(path), "%s/%s", dir, ep->d_name);
+    if (s >= 0 && s < MAX_PATH_LEN && unlink(path) == 0) {
+      ++removed;
+    }
+  }
+  closedir(dirp);
+  if (removed > 0) {
+    printf("  %zu unused %s cache entries removed\n", removed, kind);
+  }
+}
+
+static bool cache_path(char *path, const char *kind, uint64_t key) {
+  int s = snprintf(path, MAX_PATH_LEN, "%s/%s/%016llx", g_cache_dir, kind, (unsigned long long)key);
+  return s >= 0 && s < MAX_PATH_LEN;
+}
+
+bool cache_get(const char *kind, uint64_t key, string_t *value) {
+  char path[MAX_PATH_LEN];
+  if (!cache_enabled() || !cache_path(path, kind, key)) {
+    return false;
+  }
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return false;
+  }
+  mark_used(kind, key);
+  bool ok = fseek(fp, 0, SEEK_END) == 0;
+  long length = ok ? ftell(fp) : -1;
+  ok = length >= 0 && fseek(fp, 0, SEEK_SET) == 0;
+  if (ok) {
+    value->data = malloc_panic(length + 1);
+    value->length = length;
+    ok = length == 0 || fread(value->data, length, 1, fp) == 1;
+    if (ok) {
+      value->data[length] = '\0';
+    } else {
+      free(value->data);
+    }
+  }
+  fclose(fp);
+  return ok;
+}
+
+void cache_put(const char *kind, uint64_t key, const char *data, size_t length) {
+  char path[MAX_PATH_LEN];
+  char tmp_path[MAX_PATH_LEN + 8];
+  if (!cache_enabled() || !cache_path(path, kind, key)) {
+    return;
+  }
+  char kind_dir[MAX_PATH_LEN];
+  int s = snprintf(kind_dir, sizeof(kind_dir), "%s/%s", g_cache_dir, kind);
+  if (s < 0 || s >= MAX_PATH_LEN || !make_dir(kind_dir)) {
+    return;
+  }
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+  int fd = mkstemp(tmp_path);
+  if (fd == -1) {
+    return;
+  }
+  bool written = write_all(fd, data, length);
+  if (close(fd) != 0 || !written || rename(tmp_path, path) != 0) {
+    printf("Failed to write cache entry %s: %s\n", path, strerror(errno));
+    unlink(tmp_path);
+    return;
+  }
+  mark_used(kind, key);
+}
+
+typedef struct {
+  char magic[8];
+  uint32_t generation; // incremented every time the file is rewritten
+  uint32_t num_slots;  // power of two
+  uint64_t data_size;
+} code_header_t;
+
+typedef struct {
+  uint64_t key;       // 0 if the slot is empty
+  uint64_t offset;    // into the data section
+  uint32_t length;    // excluding the terminating NUL
+  uint32_t last_used; // generation
+} code_slot_t;
+
+typedef struct {
+  uint64_t key;
+  char *html;
+  uint32_t length;
+} code_entry_t;
+
+static struct {
+  void *map;
+  size_t map_size;
+  const code_header_t *header;
+  const code_slot_t *slots;
+  const char *data;
+  atomic_uchar *used; // per mapped slot
+  uint32_t generation;
+
+  pthread_rwlock_t lock; // guards the entries added since the file was mapped
+  code_entry_t *added;
+  atomic_uint num_added; // also read without the lock, to skip it while nothing was added
+  uint32_t *added_slots; // open addressing into added, UINT32_MAX if empty
+  uint32_t num_added_slots;
+} g_code_cache = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+
+static bool code_cache_path(char *path) {
+  int s = snprintf(path, MAX_PATH_LEN, "%s/" CODE_CACHE_FILE, g_cache_dir);
+  return s >= 0 && s < MAX_PATH_LEN;
+}
+
+void code_cache_open(void) {
+  char path[MAX_PATH_LEN];
+  g_code_cache.generation = 1;
+  if (!cache_enabled() || !code_cache_path(path)) {
+    return;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return;
+  }
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) == 0 && statbuf.st_size >= (off_t)sizeof(code_header_t)) {
+    void *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      g_code_cache.map = map;
+      g_code_cache.map_size = statbuf.st_size;
+    }
+  }
+  close(fd);
+  if (g_code_cache.map == NULL) {
+    return;
+  }
+
+  const code_header_t *header = g_code_cache.map;
+  size_t table_size = sizeof(code_header_t) + (size_t)header->num_slots * sizeof(code_slot_t);
+  if (memcmp(header->magic, CODE_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->num_slots == 0 || (header->num_slots & (header->num_slots - 1)) != 0 ||
+      table_size > g_code_cache.map_size ||
+      header->data_size != g_code_cache.map_size - table_size) {
+    printf("Ignoring invalid code cache %s\n", path);
+    munmap(g_code_cache.map, g_code_cache.map_size);
+    g_code_cache.map = NULL;
+    return;
+  }
+  g_code_cache.header = header;
+  g_code_cache.slots = (const code_slot_t *)(header + 1);
+  g_code_cache.data = (const char *)(g_code_cache.slots + header->num_slots);
+  g_code_cache.used = calloc(header->num_slots, sizeof(atomic_uchar));
+  if (g_code_cache.used == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+  g_code_cache.generation = header->generation + 1;
+}
+
+static uint64_t code_cache_key(uint64_t key) { return key == 0 ? 1 : key; }
+
+// Whether a mapped entry lies within the data section and ends with its NUL
+static bool code_entry_valid(const code_slot_t *entry) {
+  return entry->offset + entry->length < g_code_cache.header->data_size &&
+         g_code_cache.data[entry->offset + entry->length] == '\0';
+}
+
+bool code_cache_get(uint64_t key, const char **html) {
+  key = code_cache_key(key);
+  if (g_code_cache.header != NULL) {
+    uint32_t mask = g_code_cache.header->num_slots - 1;
+    for (uint32_t slot = key & mask; g_code_cache.slots[slot].key != 0; slot = (slot + 1) & mask) {
+      const code_slot_t *entry = &g_code_cache.slots[slot];
+      if (entry->key == key) {
+        if (!code_entry_valid(entry)) {
+          break; // a corrupt entry is a miss, and the block is highlighted again
+        }
+        atomic_store_explicit(&g_code_cache.used[slot], 1, memory_order_relaxed);
+        *html = g_code_cache.data + entry->offset;
+        return true;
+      }
+    }
+  }
+
+  if (atomic_load_explicit(&g_code_cache.num_added, memory_order_acquire) == 0) {
+    return false;
+  }
+  bool hit = false;
+  pthread_rwlock_rdlock(&g_code_cache.lock);
+  if (g_code_cache.num_added_slots > 0) {
+    uint32_t mask = g_code_cache.num_added_slots - 1;
+    for (uint32_t slot = key & mask; g_code_cache.added_slots[slot] != UINT32_MAX;
+         slot = (slot + 1) & mask) {
+      const code_entry_t *entry = &g_code_cache.added[g_code_cache.added_slots[slot]];
+      if (entry->key == key) {
+        *html = entry->html; // never moved nor freed before code_cache_flush or close
+        hit = true;
+        break;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&g_code_cache.lock);
+  return hit;
+}
+
+static void code_cache_index_added(uint32_t index) {
+  uint32_t mask = g_code_cache.num_added_slots - 1;
+  uint32_t slot = g_code_cache.added[index].key & mask;
+  while (g_code_cache.added_slots[slot] != UINT32_MAX) {
+    slot = (slot + 1) & mask;
+  }
+  g_code_cache.added_slots[slot] = index;
+}
+
+void code_cache_put(uint64_t key, const char *html, size_t length) {
+  if (!cache_enabled() || length >= UINT32_MAX) {
+    return;
+  }
+  key = code_cache_key(key);
+  char *copy = malloc_panic(length + 1);
+  memcpy(copy, html, length);
+  copy[length] = '\0';
+
+  pthread_rwlock_wrlock(&g_code_cache.lock);
+  if (2 * (g_code_cache.num_added + 1) > g_code_cache.num_added_slots) {
+    // grow both the entries and the index, keeping a load factor of at most 1/2
+    uint32_t num_slots = g_code_cache.num_added_slots ? 2 * g_code_cache.num_added_slots : 64;
+    g_code_cache.added = realloc(g_code_cache.added, num_slots / 2 * sizeof(code_entry_t));
+    free(g_code_cache.added_slots);
+    g_code_cache.added_slots = malloc_panic(num_slots * sizeof(uint32_t));
+    if (g_code_cache.added == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    memset(g_code_cache.added_slots, 0xff, num_slots * sizeof(uint32_t));
+    g_code_cache.num_added_slots = num_slots;
+    for (uint32_t i = 0; i < g_code_cache.num_added; ++i) {
+      code_cache_index_added(i);
+    }
+  }
+  g_code_cache.added[g_code_cache.num_added] =
+      (code_entry_t){.key = key, .html = copy, .length = length};
+  code_cache_index_added(g_code_cache.num_added);
+  atomic_fetch_add_explicit(&g_code_cache.num_added, 1, memory_order_release);
+  pthread_rwlock_unlock(&g_code_cache.lock);
+}
+
+typedef struct {
+  uint64_t key;
+  const char *html;
+  uint32_t length;
+  uint32_t last_used;
+} code_keep_t;
+
+static int code_keep_recent_first(const void *a, const void *b) {
+  uint32_t x = ((const code_keep_t *)a)->last_used, y = ((const code_keep_t *)b)->last_used;
+  return (x < y) - (x > y);
+}
+
+static void code_cache_write(void) {
+  char path[MAX_PATH_LEN], tmp_path[MAX_PATH_LEN + 8];
+  if (!code_cache_path(path)) {
+    return;
+  }
+  uint32_t num_mapped = g_code_cache.header ? g_code_cache.header->num_slots : 0;
+  size_t max_keep = (size_t)num_mapped + g_code_cache.num_added;
+  code_keep_t *keep = malloc_panic(max_keep * sizeof(code_keep_t));
+  uint32_t num_keep = 0;
+  for (uint32_t i = 0; i < g_code_cache.num_added; ++i) {
+    keep[num_keep++] = (code_keep_t){.key = g_code_cache.added[i].key,
+                                     .html = g_code_cache.added[i].html,
+                                     .length = g_code_cache.added[i].length,
+                                     .last_used = g_code_cache.generation};
+  }
+  for (uint32_t i = 0; i < num_mapped; ++i) {
+    const code_slot_t *slot = &g_code_cache.slots[i];
+    uint32_t last_used = atomic_load(&g_code_cache.used[i]) ? g_code_cache.generation
+                                                            : slot->last_used;
+    if (slot->key != 0 && g_code_cache.generation - last_used <= CODE_CACHE_MAX_AGE &&
+        code_entry_valid(slot)) {
+      keep[num_keep++] = (code_keep_t){.key = slot->key,
+                                       .html = g_code_cache.data + slot->offset,
+                                       .length = slot->length,
+                                       .last_used = last_used};
+    }
+  }
+  // least recently used entries are evicted first once over budget
+  qsort(keep, num_keep, sizeof(code_keep_t), code_keep_recent_first);
+  uint64_t data_size = 0;
+  uint32_t num_entries = 0;
+  while (num_entries < num_keep &&
+         data_size + keep[num_entries].length + 1 <= CODE_CACHE_MAX_BYTES) {
+    data_size += keep[num_entries++].length + 1;
+  }
+
+  code_header_t header = {.magic = CODE_CACHE_MAGIC, .generation = g_code_cache.generation};
+  header.num_slots = 64;
+  while (header.num_slots < 2 * num_entries) {
+    header.num_slots *= 2;
+  }
+  code_slot_t *slots = calloc(header.num_slots, sizeof(code_slot_t));
+  if (slots == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+  uint64_t offset = 0;
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    uint32_t slot = keep[i].key & (header.num_slots - 1);
+    while (slots[slot].key != 0 && slots[slot].key != keep[i].key) {
+      slot = (slot + 1) & (header.num_slots - 1);
+    }
+    if (slots[slot].key != 0) {
+      keep[i].length = UINT32_MAX; // duplicate from concurrent misses, skip its data
+      continue;
+    }
+    slots[slot] = (code_slot_t){
+        .key = keep[i].key, .offset = offset, .length = keep[i].length,
+        .last_used = keep[i].last_used};
+    offset += keep[i].length + 1;
+  }
+  header.data_size = offset;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+  int fd = mkstemp(tmp_path);
+  FILE *fp = fd == -1 ? NULL : fdopen(fd, "w");
+  bool ok = fp != NULL && fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(slots, sizeof(code_slot_t), header.num_slots, fp) == header.num_slots;
+  for (uint32_t i = 0; ok && i < num_entries; ++i) {
+    if (keep[i].length != UINT32_MAX) {
+      ok = fwrite(keep[i].html, keep[i].length + 1, 1, fp) == 1;
+    }
+  }
+  if (fp != NULL && fclose(fp) != 0) {
+    ok = false;
+  }
+  if (!ok || rename(tmp_path, path) != 0) {
+    printf("Failed to write code cache %s: %s\n", path, strerror(errno));
+    if (fd != -1) {
+      unlink(tmp_path);
+    }
+  }
+  free(slots);
+  free(keep);
+}
+
+void code_cache_close(void) {
+  if (cache_enabled() && g_code_cache.num_added > 0) {
+    code_cache_write();
+  }
+  for (uint32_t i = 0; i < g_code_cache.num_added; ++i) {
+    free(g_code_cache.added[i].html);
+  }
+  free(g_code_cache.added);
+  free(g_code_cache.added_slots);
+  free(g_code_cache.used);
+  if (g_code_cache.map != NULL) {
+    munmap(g_code_cache.map, g_code_cache.map_size);
+  }
+  g_code_cache.map = NULL;
+  g_code_cache.header = NULL;
+  g_code_cache.used = NULL;
+  g_code_cache.added = NULL;
+  g_code_cache.num_added = 0;
+  g_code_cache.added_slots = NULL;
+  g_code_cache.num_added_slots = 0;
+}
+
+void code_cache_flush(void) {
+  if (g_code_cache.num_added > 0) {
+    code_cache_close();
+    code_cache_open();
+  }
+}
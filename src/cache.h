@@ -0,0 +1,42 @@
+#ifndef _SSG_CACHE_H_
+#define _SSG_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util.h"
+
+/*
+ * Persistent build cache. Entries live in <dir>/<kind>/<key as hex> and are replaced atomically,
+ * so concurrent workers and interrupted builds never observe partial entries.
+ */
+
+// dir == NULL disables the cache
+extern void cache_init(const char *dir);
+extern bool cache_enabled(void);
+// On a hit, value receives a malloc'd, NUL-terminated copy of the entry
+extern bool cache_get(const char *kind, uint64_t key, string_t *value);
+extern void cache_put(const char *kind, uint64_t key, const char *data, size_t length);
+/*
+ * Entries are never replaced under the same key, so old ones pile up as their sources change. A
+ * full build uses every entry it still needs; the others are removed after it.
+ */
+extern void cache_sweep_begin(void);
+// Removes the entries of kind that were neither read nor written since cache_sweep_begin()
+extern void cache_sweep(const char *kind);
+
+/*
+ * Cache of highlighted code blocks in a single memory-mapped file. Lookups probe the mapped
+ * table directly; new entries are kept in memory and merged into a fresh file on close, which
+ * also evicts entries that went unused for many builds or overflow the size budget.
+ */
+
+extern void code_cache_open(void);
+// On a hit, html points to a NUL-terminated string that is valid until the next flush or close
+extern bool code_cache_get(uint64_t key, const char **html);
+extern void code_cache_put(uint64_t key, const char *html, size_t length);
+// Merges the new entries into the file and maps it again, between builds of a long session
+extern void code_cache_flush(void);
+extern void code_cache_close(void);
+
+#endif
@@ -0,0 +1,199 @@
+#include "compress.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "output.h"
+#include "util.h"
+
+#define COMPRESS_XATTR "user.sausage.source"
+
+static bool g_compress_enabled = false;
+
+static const char *g_compressible_exts[] = {
+    ".html", ".xml", ".css", ".js", ".mjs", ".json", ".svg", ".txt", ".wasm", ".map",
+};
+
+void compress_init(bool enabled) { g_compress_enabled = enabled; }
+
+bool compress_enabled(void) { return g_compress_enabled; }
+
+bool compress_wanted(const char *path) {
+  const char *ext = strrchr(path, '.');
+  if (ext == NULL || strchr(ext, '/') != NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < arrlen(g_compressible_exts); ++i) {
+    if (strcmp(ext, g_compressible_exts[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// What a sibling was compressed from. Files compressed in place also keep their mtime, so that an
+// unchanged one is recognised without reading it, like asset_hash() does. Pages leave it 0.
+typedef struct {
+  uint64_t hash;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+} compress_source_t;
+
+typedef void (*compress_fn_t)(const char *path, const void *data, size_t length,
+                              const compress_source_t *source);
+
+static bool sibling_source(const char *path, compress_source_t *stored) {
+  return getxattr(path, COMPRESS_XATTR, stored, sizeof(*stored)) == sizeof(*stored);
+}
+
+static void write_sibling(const char *path, const void *data, size_t length,
+                          const compress_source_t *source) {
+  char tmp[MAX_PATH_LEN];
+  int fd = output_temp(path, tmp);
+  if (fd < 0) {
+    PANIC_ERRNO("Failed to create a temporary file for %s", path);
+  }
+  if (!write_all(fd, data, length)) {
+    output_discard(fd, tmp);
+    PANIC_ERRNO("Failed to write to file %s", tmp);
+  }
+  // without xattr support the sibling is simply compressed again next time
+  fsetxattr(fd, COMPRESS_XATTR, source, sizeof(*source), 0);
+  if (!output_replace(fd, tmp, path)) {
+    PANIC_ERRNO("Failed to replace %s", path);
+  }
+}
+
+static void compress_gzip(const char *path, const void *data, size_t length,
+                          const compress_source_t *source) {
+  z_stream zs = {0};
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+    PANIC("Failed to initialise gzip for %s", path);
+  }
+  size_t capacity = deflateBound(&zs, length);
+  unsigned char *out = malloc_panic(capacity);
+  zs.next_in = (unsigned char *)data;
+  zs.avail_in = length;
+  zs.next_out = out;
+  zs.avail_out = capacity;
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+    PANIC("Failed to gzip %s", path);
+  }
+  write_sibling(path, out, zs.total_out, source);
+  deflateEnd(&zs);
+  free(out);
+}
+
+#ifdef HAVE_ZSTD
+static void compress_zstd(const char *path, const void *data, size_t length,
+                          const compress_source_t *source) {
+  size_t capacity = ZSTD_compressBound(length);
+  void *out = malloc_panic(capacity);
+  size_t size = ZSTD_compress(out, capacity, data, length, COMPRESS_ZSTD_LEVEL);
+  if (ZSTD_isError(size)) {
+    PANIC("Failed to zstd %s: %s", path, ZSTD_getErrorName(size));
+  }
+  write_sibling(path, out, size, source);
+  free(out);
+}
+#endif
+
+static void sibling_path(char *sibling, const char *path, const char *ext) {
+  int s = snprintf(sibling, MAX_PATH_LEN, "%s%s", path, ext);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct compressed path for %s", path);
+  }
+}
+
+void compress_remove(const char *path) {
+  char sibling[MAX_PATH_LEN];
+  sibling_path(sibling, path, ".gz");
+  unlink(sibling);
+#ifdef HAVE_ZSTD
+  sibling_path(sibling, path, ".zst");
+  unlink(sibling);
+#endif
+}
+
+static void update_sibling(const char *path, const char *ext, compress_fn_t compress,
+                           const void *data, size_t length, const compress_source_t *source) {
+  char sibling[MAX_PATH_LEN];
+  sibling_path(sibling, path, ext);
+  compress_source_t stored;
+  if (!sibling_source(sibling, &stored) || stored.hash != source->hash ||
+      stored.size != source->size) {
+    compress(sibling, data, length, source);
+  } else if (stored.mtime_sec != source->mtime_sec || stored.mtime_nsec != source->mtime_nsec) {
+    // the same bytes under a new mtime, so only the record changes
+    setxattr(sibling, COMPRESS_XATTR, source, sizeof(*source), 0);
+  }
+}
+
+static void update_siblings(const char *path, const void *data, size_t length,
+                            const compress_source_t *source) {
+  update_sibling(path, ".gz", compress_gzip, data, length, source);
+#ifdef HAVE_ZSTD
+  update_sibling(path, ".zst", compress_zstd, data, length, source);
+#endif
+}
+
+// Whether the sibling was compressed from a file of this size and mtime
+static bool sibling_unchanged(const char *path, const char *ext, const compress_source_t *source) {
+  char sibling[MAX_PATH_LEN];
+  sibling_path(sibling, path, ext);
+  compress_source_t stored;
+  return sibling_source(sibling, &stored) && stored.size == source->size &&
+         stored.mtime_sec == source->mtime_sec && stored.mtime_nsec == source->mtime_nsec;
+}
+
+void compress_output(const char *path, const void *data, size_t length, uint64_t hash) {
+  if (length < COMPRESS_MIN_SIZE) {
+    compress_remove(path); // it may have been larger before
+    return;
+  }
+  update_siblings(path, data, length, &(compress_source_t){.hash = hash, .size = length});
+}
+
+void compress_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat statbuf;
+  if (fd < 0 || fstat(fd, &statbuf) != 0) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  if (statbuf.st_size < COMPRESS_MIN_SIZE) {
+    compress_remove(path);
+    close(fd);
+    return;
+  }
+  compress_source_t source = {
+      .size = statbuf.st_size,
+      .mtime_sec = statbuf.st_mtim.tv_sec,
+      .mtime_nsec = statbuf.st_mtim.tv_nsec,
+  };
+  // copies keep the mtime of their source, so an unchanged one is not read at all
+  bool unchanged = sibling_unchanged(path, ".gz", &source);
+#ifdef HAVE_ZSTD
+  unchanged = unchanged && sibling_unchanged(path, ".zst", &source);
+#endif
+  if (unchanged) {
+    close(fd);
+    return;
+  }
+  void *data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    PANIC_ERRNO("Failed to map %s", path);
+  }
+  source.hash = hash_bytes(data, statbuf.st_size);
+  update_siblings(path, data, statbuf.st_size, &source);
+  munmap(data, statbuf.st_size);
+  close(fd);
+}
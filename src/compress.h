@@ -0,0 +1,26 @@
+#ifndef _SSG_COMPRESS_H_
+#define _SSG_COMPRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Precompressed siblings for outputs: path.gz at maximum compression, and path.zst at
+ * COMPRESS_ZSTD_LEVEL when built with HAVE_ZSTD. The hash of what was compressed is kept in an
+ * extended attribute on each sibling, so unchanged outputs are not compressed again, and for static
+ * files also their size and mtime, so unchanged ones are not even read. Outputs under
+ * COMPRESS_MIN_SIZE are left alone, since the headers would eat the savings.
+ */
+
+extern void compress_init(bool enabled);
+extern bool compress_enabled(void);
+// Whether path has a type worth compressing
+extern bool compress_wanted(const char *path);
+// data is the content of path and hash its hash_bytes()
+extern void compress_output(const char *path, const void *data, size_t length, uint64_t hash);
+extern void compress_file(const char *path);
+// Removes the siblings of path, if there are any
+extern void compress_remove(const char *path);
+
+#endif
@@ -6,10 +6,21 @@
 #define SSG_VERSION_MINOR (SSG_VERSION % 100)
 
 #define METADATA_FILE "sausage.toml"
+#define POSTS_DIR "posts"
 #define STATIC_DIR "static"
+#define TEMPLATE_DIR "templates"
+#define TEMPLATE_EXT ".mustache"
 #define WASM_DIR "result/bin/wasm"
 #define OUTPUT_DIR "public"
+#define CACHE_DIR ".cache"
+#define ASSET_MANIFEST OUTPUT_DIR "/assets.json"
+#define OUTPUT_MANIFEST CACHE_DIR "/outputs"
+#define SERVE_PORT 8000
 
 #define MAX_PATH_LEN 1024
+#define MAX_JOBS 256
+#define COMPRESS_MIN_SIZE 256
+// the levels above 19 need far more time and memory for a few bytes
+#define COMPRESS_ZSTD_LEVEL 19
 
 #endif
@@ -3,12 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef __SSE4_2__
-#ifdef _MSC_VER
-#include <nmmintrin.h>
-#else
-#include <x86intrin.h>
-#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HESC_X86 1
+#include <immintrin.h>
 #endif
 
 #if __GNUC__ >= 3
@@ -27,6 +24,8 @@ static const char *ESCAPED_STRING[] = {
 // Mapping: 1 => 6, 2 => 5, 3 => 5, 4 => 4, 5 => 4
 #define ESC_LEN(x) ((13 - x) / 2)
 
+#define ESC_APOS 3
+
 /*
  * Given ASCII-compatible character, return index of ESCAPED_STRING.
  *
@@ -47,100 +46,123 @@ static const char HTML_ESCAPE_TABLE[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-static uint8_t *ensure_allocated(uint8_t *buf, size_t size, size_t *asize) {
-  if (size < *asize)
-    return buf;
+static inline int escape_index(uint8_t c, int flags) {
+  int esc_i = HTML_ESCAPE_TABLE[c];
+  return (esc_i == ESC_APOS && !(flags & HESC_APOS)) ? 0 : esc_i;
+}
 
-  size_t new_size;
-  if (*asize == 0) {
-    new_size = size;
-  } else {
-    new_size = *asize;
-  }
+static size_t find_scalar(const uint8_t *buf, size_t i, size_t size, int flags) {
+  while (i < size && escape_index(buf[i], flags) == 0)
+    i++;
+  return i;
+}
 
-  // Increase buffer size by 1.5x if realloced multiple times.
-  while (new_size < size)
-    new_size = (new_size << 1) - (new_size >> 1);
+#ifdef HESC_X86
+/*
+ * The vector kernels scan whole blocks and leave the tail to find_scalar. ' is part of the set
+ * only with HESC_APOS; otherwise its lane compares against " a second time.
+ */
 
-  *asize = new_size;
-  return realloc(buf, new_size);
+__attribute__((target("sse2"))) static size_t find_sse2(const uint8_t *buf, size_t i,
+                                                        size_t size, int flags) {
+  const __m128i quot = _mm_set1_epi8('"'), amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<'),
+                gt = _mm_set1_epi8('>'),
+                apos = _mm_set1_epi8((flags & HESC_APOS) ? '\'' : '"');
+  for (; size - i >= 16; i += 16) {
+    __m128i b16 = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b16, quot), _mm_cmpeq_epi8(b16, amp)),
+                              _mm_or_si128(_mm_cmpeq_epi8(b16, lt), _mm_cmpeq_epi8(b16, gt)));
+    int mask = _mm_movemask_epi8(_mm_or_si128(eq, _mm_cmpeq_epi8(b16, apos)));
+    if (unlikely(mask != 0))
+      return i + __builtin_ctz(mask);
+  }
+  return find_scalar(buf, i, size, flags);
 }
 
-#ifdef __SSE4_2__
-static size_t find_char_fast(const char *buf, size_t i, size_t size, __m128i range,
-                             size_t range_size, int *found) {
-  size_t left = (size - i) & ~15;
-  do {
-    __m128i b16 = _mm_loadu_si128((void *)(buf + i));
+__attribute__((target("sse4.2"))) static size_t find_sse42(const uint8_t *buf, size_t i,
+                                                           size_t size, int flags) {
+  const __m128i range = _mm_loadu_si128((const __m128i *)"\"&<>'\0\0\0\0\0\0\0\0\0\0\0");
+  const int range_size = (flags & HESC_APOS) ? 5 : 4;
+  for (; size - i >= 16; i += 16) {
+    __m128i b16 = _mm_loadu_si128((const __m128i *)(buf + i));
     int index = _mm_cmpestri(range, range_size, b16, 16, _SIDD_CMP_EQUAL_ANY);
-    if (unlikely(index != 16)) {
-      i += index;
-      *found = 1;
-      break;
-    }
-    i += 16;
-    left -= 16;
-  } while (likely(left != 0));
+    if (unlikely(index != 16))
+      return i + index;
+  }
+  return find_scalar(buf, i, size, flags);
+}
 
-  return i;
+__attribute__((target("avx2"))) static size_t find_avx2(const uint8_t *buf, size_t i,
+                                                        size_t size, int flags) {
+  const __m256i quot = _mm256_set1_epi8('"'), amp = _mm256_set1_epi8('&'),
+                lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>'),
+                apos = _mm256_set1_epi8((flags & HESC_APOS) ? '\'' : '"');
+  for (; size - i >= 32; i += 32) {
+    __m256i b32 = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i eq =
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(b32, quot), _mm256_cmpeq_epi8(b32, amp)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(b32, lt), _mm256_cmpeq_epi8(b32, gt)));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(eq, _mm256_cmpeq_epi8(b32, apos)));
+    if (unlikely(mask != 0))
+      return i + __builtin_ctz(mask);
+  }
+  return find_sse2(buf, i, size, flags);
 }
 #endif
 
-static inline size_t append_pending_buf(uint8_t *rbuf, size_t rbuf_i, const uint8_t *buf,
-                                        size_t buf_i, size_t esize) {
-  memcpy(rbuf + rbuf_i, buf + (rbuf_i - esize), buf_i - (rbuf_i - esize));
-  return buf_i + esize;
+static size_t (*find_char)(const uint8_t *, size_t, size_t, int) = find_scalar;
+
+#ifdef HESC_X86
+// Runs before main, so the kernel is fixed before any thread escapes anything.
+__attribute__((constructor)) static void select_find_char(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    find_char = find_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    find_char = find_sse42;
+  } else if (__builtin_cpu_supports("sse2")) {
+    find_char = find_sse2;
+  }
 }
+#endif
 
-static inline size_t append_escaped_buf(uint8_t *rbuf, size_t rbuf_i, size_t esc_i, size_t *esize) {
-  memcpy(rbuf + rbuf_i, ESCAPED_STRING[esc_i], ESC_LEN(esc_i));
-  *esize += ESC_LEN(esc_i) - 1;
-  return rbuf_i + ESC_LEN(esc_i);
+size_t hesc_find(const uint8_t *buf, size_t size, int flags) {
+  return find_char(buf, 0, size, flags);
 }
 
-size_t hesc_escape_html(uint8_t **dest, const uint8_t *buf, size_t size) {
-  size_t asize = 0, esc_i, esize = 0, i = 0, rbuf_i = 0;
-  uint8_t *rbuf = NULL;
-
-#ifdef __SSE4_2__
-  __m128i escapes5 = _mm_loadu_si128((const __m128i *)"\"&'<>");
-  while (likely(size - i >= 16)) {
-    int found = 0;
-    if (unlikely((esc_i = HTML_ESCAPE_TABLE[buf[i]]) == 0)) {
-      i = find_char_fast(buf, i, size, escapes5, 5, &found);
-      if (!found)
-        break;
-      esc_i = HTML_ESCAPE_TABLE[buf[i]];
-    }
-    rbuf = ensure_allocated(rbuf, sizeof(uint8_t) * (size + esize + ESC_LEN(esc_i) + 1), &asize);
-    rbuf_i = append_pending_buf(rbuf, rbuf_i, buf, i, esize);
-    rbuf_i = append_escaped_buf(rbuf, rbuf_i, esc_i, &esize);
-    i++;
-  }
-#endif
-
+size_t hesc_escape_html_into(uint8_t *dest, const uint8_t *buf, size_t size, int flags) {
+  size_t i = 0, dest_i = 0, esc_i;
   while (i < size) {
-    // Loop here to skip non-escaped characters fast.
-    while (i < size && (esc_i = HTML_ESCAPE_TABLE[buf[i]]) == 0)
-      i++;
-
-    if (esc_i) {
-      rbuf = ensure_allocated(rbuf, sizeof(uint8_t) * (size + esize + ESC_LEN(esc_i) + 1), &asize);
-      rbuf_i = append_pending_buf(rbuf, rbuf_i, buf, i, esize);
-      rbuf_i = append_escaped_buf(rbuf, rbuf_i, esc_i, &esize);
-    }
-    i++;
+    size_t j = find_char(buf, i, size, flags);
+    memcpy(dest + dest_i, buf + i, j - i);
+    dest_i += j - i;
+    if (j == size)
+      break;
+    esc_i = HTML_ESCAPE_TABLE[buf[j]];
+    memcpy(dest + dest_i, ESCAPED_STRING[esc_i], ESC_LEN(esc_i));
+    dest_i += ESC_LEN(esc_i);
+    i = j + 1;
   }
+  return dest_i;
+}
 
-  if (rbuf_i == 0) {
+size_t hesc_escape_html(uint8_t **dest, const uint8_t *buf, size_t size) {
+  size_t i = find_char(buf, 0, size, HESC_APOS);
+  if (i == size) {
     // Return given buf and size if there are no escaped characters.
     *dest = (uint8_t *)buf;
     return size;
-  } else {
-    append_pending_buf(rbuf, rbuf_i, buf, size, esize);
-    rbuf[size + esize] = '\0';
-
-    *dest = rbuf;
-    return size + esize;
   }
+
+  size_t esize = 0;
+  for (; i < size; i = find_char(buf, i + 1, size, HESC_APOS))
+    esize += ESC_LEN(HTML_ESCAPE_TABLE[buf[i]]) - 1;
+  uint8_t *rbuf = malloc(size + esize + 1);
+  if (rbuf == NULL)
+    return 0;
+  hesc_escape_html_into(rbuf, buf, size, HESC_APOS);
+  rbuf[size + esize] = '\0';
+
+  *dest = rbuf;
+  return size + esize;
 }
@@ -18,4 +18,25 @@
  */
 extern size_t hesc_escape_html(uint8_t **dest, const uint8_t *src, size_t size);
 
+/*
+ * Flags for hesc_find and hesc_escape_html_into. Without HESC_APOS, ' is left as is, which is
+ * what mustache does.
+ */
+#define HESC_APOS 1
+
+/*
+ * Return the index of the first character in src that needs escaping, or size if there is none.
+ * Uses the widest of AVX2, SSE4.2 and SSE2 the CPU supports, picked once at startup.
+ */
+extern size_t hesc_find(const uint8_t *src, size_t size, int flags);
+
+/*
+ * Same replacements as hesc_escape_html, written straight into dest, which must have room for
+ * HESC_MAX_ESCAPED(size) bytes. Nothing is allocated and dest is not NUL-terminated.
+ *
+ * @return number of bytes written to dest.
+ */
+#define HESC_MAX_ESCAPED(size) ((size) * 6)
+extern size_t hesc_escape_html_into(uint8_t *dest, const uint8_t *src, size_t size, int flags);
+
 #endif
@@ -7,86 +7,117 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "asset.h"
+#include "build.h"
+#include "cache.h"
+#include "compress.h"
 #include "conf.h"
-#include "meta.h"
-#include "mustach/mustach.h"
+#include "minify.h"
+#include "output.h"
+#include "prof.h"
 #include "tmpl.h"
-
-#include <unistd.h>
+#include "util.h"
+#include "serve.h"
+#include "watch.h"
 
 int main(int argc, char **argv) {
   char *wasmdir = WASM_DIR;
+  uint32_t num_jobs = 1;
+  char *cachedir = CACHE_DIR;
+  bool watch = false;
+  bool serve = false;
+  uint16_t port = SERVE_PORT;
   for (int i = 1; i < argc; ++i) {
     if (strcmp("--wasm", argv[i]) == 0) {
       if (++i >= argc) {
         PANIC("No value for --wasm given");
       }
       wasmdir = argv[i];
+    } else if (strcmp("--jobs", argv[i]) == 0 || strcmp("-j", argv[i]) == 0) {
+      if (++i >= argc) {
+        PANIC("No value for --jobs given");
+      }
+      char *end;
+      unsigned long n = strtoul(argv[i], &end, 10);
+      if (*end != '\0' || n == 0 || n > MAX_JOBS) {
+        PANIC("Invalid value for --jobs: %s (expected 1-%d)", argv[i], MAX_JOBS);
+      }
+      num_jobs = n;
+    } else if (strcmp("--no-cache", argv[i]) == 0) {
+      cachedir = NULL;
+    } else if (strcmp("--compress", argv[i]) == 0) {
+      compress_init(true);
+    } else if (strcmp("--fingerprint", argv[i]) == 0) {
+      assets_init(true);
+    } else if (strncmp("--profile=", argv[i], strlen("--profile=")) == 0) {
+      if (argv[i][strlen("--profile=")] == '\0') {
+        PANIC("No path for --profile given");
+      }
+      prof_init(argv[i] + strlen("--profile="));
+    } else if (strcmp("--low-memory", argv[i]) == 0) {
+      low_memory_init(true);
+    } else if (strcmp("--minify", argv[i]) == 0) {
+      minify_init(true);
+    } else if (strcmp("--watch", argv[i]) == 0) {
+      watch = true;
+    } else if (strcmp("serve", argv[i]) == 0) {
+      serve = true;
+    } else if (strcmp("--port", argv[i]) == 0) {
+      if (++i >= argc) {
+        PANIC("No value for --port given");
+      }
+      char *end;
+      unsigned long n = strtoul(argv[i], &end, 10);
+      if (*end != '\0' || n == 0 || n > UINT16_MAX) {
+        PANIC("Invalid value for --port: %s", argv[i]);
+      }
+      port = n;
     }
   }
 
-  printf("PARSING METADATA FILE " METADATA_FILE "\n");
-  meta_t *meta = meta_parse(METADATA_FILE);
-  meta_debug(meta);
-
-  printf("SETTING UP OUTPUT DIRECTORY " OUTPUT_DIR "\n");
-  make_output_dir(OUTPUT_DIR);
-  make_output_dir(OUTPUT_DIR "/post");
-  make_output_dir(OUTPUT_DIR "/scripts");
-  make_output_dir(OUTPUT_DIR "/scripts/post");
-  make_output_dir(OUTPUT_DIR "/tag");
-  make_output_dir(OUTPUT_DIR "/wasm");
+  build_t *build = build_new(num_jobs, wasmdir);
+  build_load_meta(build);
 
-  copy_files(STATIC_DIR, OUTPUT_DIR);
-  copy_files(STATIC_DIR "/scripts", OUTPUT_DIR "/scripts");
-  copy_files(STATIC_DIR "/scripts/post", OUTPUT_DIR "/scripts/post");
-  copy_files(wasmdir, OUTPUT_DIR "/wasm");
+  cache_init(cachedir);
+  code_cache_open();
 
-  printf("GENERATING PAGES\n");
+  printf("LOADING TEMPLATES FROM " TEMPLATE_DIR "\n");
+  templates_load(TEMPLATE_DIR);
+  templates_check(build->meta);
 
-  closure_t closure = {
-      .meta = meta,
-      .state = ROOT,
-      .index = 0,
-      .index_inner = 0,
-  };
-
-  for (uint32_t i = 0; i < meta->num_pages; ++i) {
-    printf("  " OUTPUT_DIR "/%s\n", meta->pages[i]);
-    string_t tmpl = read_template(meta->pages[i]);
-    render_file(&closure, tmpl, meta->pages[i], "html");
-    free(tmpl.data);
+  if (serve) {
+    // pages are rendered on request, so there is nothing to build up front
+    serve_run(build, port);
+    prof_finish();
+    templates_free();
+    code_cache_close();
+    build_free(build);
+    return 0;
   }
-  printf("  " OUTPUT_DIR "/rss.xml\n");
-  string_t tmpl = read_template("rss");
-  render_file(&closure, tmpl, "rss", "xml");
-  free(tmpl.data);
 
-  string_t tmpl_post = read_template("post");
-  closure.state = POST;
-  for (size_t i = 0; i < meta->num_posts; ++i) {
-    closure.index = i;
-    char slug[256];
-    snprintf(slug, sizeof(slug), "post/%s", meta->posts[i].slug);
-    printf("  " OUTPUT_DIR "/%s\n", slug);
-    render_file(&closure, tmpl_post, slug, "html");
-  }
-  free(tmpl_post.data);
+  outputs_load(OUTPUT_MANIFEST);
+  build_setup_output(build);
+
+  printf("GENERATING PAGES (%u jobs)\n", num_jobs);
+  // every post's content comes from the cache or goes into it, rebuilds may reuse it from memory
+  cache_sweep_begin();
+  build_queue_all(build);
+  build_run(build);
+  cache_sweep("content");
 
-  string_t tmpl_tag = read_template("tag");
-  closure.state = TAG;
-  for (size_t i = 0; i < meta->num_tags; ++i) {
-    closure.index = i;
-    char slug[256];
-    snprintf(slug, sizeof(slug), "tag/%s", meta->tags[i].id);
-    printf("  " OUTPUT_DIR "/%s\n", slug);
-    render_file(&closure, tmpl_tag, slug, "html");
+  if (watch) {
+    watch_run(build);
   }
-  free(tmpl_tag.data);
 
-  meta_free(meta);
+  prof_finish();
+  templates_free();
+  assets_free();
+  outputs_free();
+  code_cache_close();
+  build_free(build);
 }
@@ -4,69 +4,153 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "conf.h"
+#include "prof.h"
 #include "util.h"
 
 #define TOML_ERRBUF_SIZE 256
 
-#define MAX_TAGS 256
-#define MAX_POSTS_PER_TAG 64
+static uint32_t *tag_slot(const meta_t *meta, const char *id) {
+  for (size_t i = hash_bytes(id, strlen(id)) & meta->tag_index_mask;;
+       i = (i + 1) & meta->tag_index_mask) {
+    uint32_t handle = meta->tag_index[i];
+    if (handle == META_NO_TAG || meta->tags[handle].id == id ||
+        strcmp(meta->tags[handle].id, id) == 0) {
+      return &meta->tag_index[i];
+    }
+  }
+}
 
-uint32_t meta_tag_handle(const meta_t *meta, const char *tag) {
-  for (int i = 0; i < meta->num_tags; ++i) {
-    if (strcmp(tag, meta->tags[i].id) == 0) {
-      return i;
+uint32_t meta_tag_handle(const meta_t *meta, const char *id) {
+  return meta->tag_index_mask ? *tag_slot(meta, id) : META_NO_TAG;
+}
+
+static uint32_t *post_slot(const meta_t *meta, const char *slug) {
+  for (size_t i = hash_bytes(slug, strlen(slug)) & meta->post_index_mask;;
+       i = (i + 1) & meta->post_index_mask) {
+    uint32_t handle = meta->post_index[i];
+    if (handle == META_NO_POST || strcmp(meta->posts[handle].slug, slug) == 0) {
+      return &meta->post_index[i];
     }
   }
-  return -1;
 }
 
-int meta_add_tag(meta_t *meta, char *id) {
-  if (meta->num_tags == MAX_TAGS) {
-    PANIC("Exceeded maximum tag count of %d", MAX_TAGS);
+uint32_t meta_post_handle(const meta_t *meta, const char *slug) {
+  return meta->post_index_mask ? *post_slot(meta, slug) : META_NO_POST;
+}
+
+// Indexes the posts by slug once they are sorted, which fixes their handles. At most half full.
+static void meta_index_posts(meta_t *meta) {
+  size_t capacity = 64;
+  while (capacity < 2 * (size_t)meta->num_posts) {
+    capacity *= 2;
+  }
+  meta->post_index = arena_alloc(&meta->arena, capacity * sizeof(uint32_t));
+  memset(meta->post_index, 0xff, capacity * sizeof(uint32_t)); // META_NO_POST
+  meta->post_index_mask = capacity - 1;
+  for (uint32_t i = 0; i < meta->num_posts; ++i) {
+    *post_slot(meta, meta->posts[i].slug) = i;
+  }
+}
+
+// Doubles the tag array and the index, which is kept at most half full
+static void meta_grow_tags(meta_t *meta) {
+  size_t capacity = meta->tag_index_mask ? meta->tag_index_mask + 1 : 64;
+  meta_tag_t *tags = arena_alloc(&meta->arena, capacity * sizeof(meta_tag_t));
+  if (meta->num_tags > 0) {
+    memcpy(tags, meta->tags, meta->num_tags * sizeof(meta_tag_t));
   }
-  int ret = meta->num_tags;
-  meta->tags[ret] = (meta_tag_t){
-      .id = id, .post_handles = malloc_panic(MAX_POSTS_PER_TAG * sizeof(uint32_t)), .num_posts = 0};
-  ++meta->num_tags;
-  return ret;
+  meta->tags = tags; // the old array stays in the arena until meta_free
+  meta->tag_index = arena_alloc(&meta->arena, 2 * capacity * sizeof(uint32_t));
+  memset(meta->tag_index, 0xff, 2 * capacity * sizeof(uint32_t)); // META_NO_TAG
+  meta->tag_index_mask = 2 * capacity - 1;
+  for (uint32_t i = 0; i < meta->num_tags; ++i) {
+    *tag_slot(meta, meta->tags[i].id) = i;
+  }
+}
+
+// Returns the handle of tag id, adding the tag if it is new
+static uint32_t meta_add_tag(meta_t *meta, char *id) {
+  if (2 * (meta->num_tags + 1) > meta->tag_index_mask + 1) {
+    meta_grow_tags(meta);
+  }
+  uint32_t *slot = tag_slot(meta, id);
+  if (*slot == META_NO_TAG) {
+    *slot = meta->num_tags;
+    meta->tags[meta->num_tags++] = (meta_tag_t){.id = id, .post_handles = NULL, .num_posts = 0};
+  }
+  return *slot;
 }
 
-void meta_add_tag_to_post(meta_t *meta, uint32_t post_handle, uint32_t local_tag_idx,
-                          uint32_t tag_handle) {
+// Post lists are filled in after the posts are sorted, here they are only counted
+static void meta_add_tag_to_post(meta_t *meta, uint32_t post_handle, uint32_t local_tag_idx,
+                                 uint32_t tag_handle) {
   meta->posts[post_handle].tag_handles[local_tag_idx] = tag_handle;
-  meta_tag_t *tag = &meta->tags[tag_handle];
-  tag->post_handles[tag->num_posts] = post_handle;
-  ++tag->num_posts;
+  ++meta->tags[tag_handle].num_posts;
+}
+
+// Lays out every tag's post list in one array, in post order
+static void meta_fill_tag_posts(meta_t *meta, size_t num_tag_refs) {
+  uint32_t *post_handles = arena_calloc(&meta->arena, num_tag_refs, sizeof(uint32_t));
+  for (uint32_t i = 0; i < meta->num_tags; ++i) {
+    meta->tags[i].post_handles = post_handles;
+    post_handles += meta->tags[i].num_posts;
+    meta->tags[i].num_posts = 0;
+  }
+  for (uint32_t post_handle = 0; post_handle < meta->num_posts; ++post_handle) {
+    const meta_post_t *post = &meta->posts[post_handle];
+    for (uint32_t j = 0; j < post->num_tags; ++j) {
+      meta_tag_t *tag = &meta->tags[post->tag_handles[j]];
+      tag->post_handles[tag->num_posts++] = post_handle;
+    }
+  }
 }
 
 int meta_post_date_cmp(const void *a, const void *b) {
   return -strncmp(((meta_post_t *)a)->date, ((meta_post_t *)b)->date, 10);
 }
 
+// Moves a string returned by toml into the arena
+static char *arena_take(arena_t *arena, char *str) {
+  char *interned = arena_intern(arena, str);
+  free(str);
+  return interned;
+}
+
 meta_t *meta_render(const toml_table_t *meta_toml) {
-  meta_t *meta = malloc_panic(sizeof(meta_t));
+  // everything but the lazily rendered content lives in the arena, including meta itself
+  arena_t arena = {0};
+  meta_t *meta = arena_calloc(&arena, 1, sizeof(meta_t));
 
   toml_datum_t site_name_toml = toml_string_in(meta_toml, "site_name");
   if (!site_name_toml.ok) {
     PANIC("Failed to get site name");
   }
-  meta->site_name = site_name_toml.u.s;
+  meta->site_name = arena_take(&arena, site_name_toml.u.s);
 
   toml_datum_t site_url_toml = toml_string_in(meta_toml, "site_url");
   if (!site_url_toml.ok) {
     PANIC("Failed to get site url");
   }
-  meta->site_url = site_url_toml.u.s;
+  meta->site_url = arena_take(&arena, site_url_toml.u.s);
 
   toml_datum_t site_desc_toml = toml_string_in(meta_toml, "site_desc");
   if (!site_desc_toml.ok) {
     PANIC("Failed to get site desc");
   }
-  meta->site_desc = site_desc_toml.u.s;
+  meta->site_desc = arena_take(&arena, site_desc_toml.u.s);
 
-  meta->version = malloc_panic(8);
+  meta->version = arena_alloc(&arena, 8);
   snprintf(meta->version, 8, "v%d.%d", SSG_VERSION_MAJOR, SSG_VERSION_MINOR);
 
+  if (toml_key_exists(meta_toml, "per_page")) {
+    toml_datum_t per_page_toml = toml_int_in(meta_toml, "per_page");
+    if (!per_page_toml.ok || per_page_toml.u.i < 1 || per_page_toml.u.i > UINT32_MAX) {
+      PANIC("Failed to get per_page: expected a positive integer");
+    }
+    meta->per_page = per_page_toml.u.i;
+  }
+
   toml_table_t *post_toml = toml_table_in(meta_toml, "post");
   meta->num_posts = 0;
   if (post_toml) {
@@ -74,41 +158,52 @@ meta_t *meta_render(const toml_table_t *meta_toml) {
       ++meta->num_posts;
     }
   }
-  meta->posts = malloc_panic(meta->num_posts * sizeof(meta_post_t));
-  meta->tags = malloc_panic(MAX_TAGS * sizeof(meta_tag_t));
+  meta->posts = arena_calloc(&arena, meta->num_posts, sizeof(meta_post_t));
+
+  meta->tags = NULL;
   meta->num_tags = 0;
+  meta->tag_index = NULL;
+  meta->tag_index_mask = 0;
 
   toml_array_t *pages_toml = toml_array_in(meta_toml, "pages");
   assert(pages_toml != NULL);
   assert(toml_array_type(pages_toml) == 's' || toml_array_type(pages_toml) == 0);
   meta->num_pages = toml_array_nelem(pages_toml);
-  meta->pages = malloc_panic(meta->num_pages * sizeof(char *));
+  meta->pages = arena_calloc(&arena, meta->num_pages, sizeof(char *));
   for (uint32_t i = 0; i < meta->num_pages; ++i) {
     toml_datum_t page_toml = toml_string_at(pages_toml, i);
     assert(page_toml.ok);
-    meta->pages[i] = page_toml.u.s;
+    meta->pages[i] = arena_take(&arena, page_toml.u.s);
   }
 
+  meta->arena = arena; // meta_add_tag allocates from meta->arena from here on
+  size_t num_tag_refs = 0;
   for (uint32_t post_handle = 0; post_handle < meta->num_posts; ++post_handle) {
     meta->posts[post_handle].content = NULL; // lazy loaded during template rendering
-    meta->posts[post_handle].js = NULL;      // lazy loaded during template rendering
     const char *slug = toml_key_in(post_toml, post_handle);
-    meta->posts[post_handle].slug = malloc_panic(strlen(slug) + 1);
-    strcpy(meta->posts[post_handle].slug, slug);
+    meta->posts[post_handle].slug = arena_intern(&meta->arena, slug);
+
+    char js[MAX_PATH_LEN];
+    int bytes = snprintf(js, sizeof(js), "/scripts/post/%s.js", slug);
+    if (bytes < 0 || bytes >= MAX_PATH_LEN) {
+      PANIC("Failed to construct script path for post %s", slug);
+    }
+    meta->posts[post_handle].js = arena_strdup(&meta->arena, js);
+
     toml_table_t *post_i_toml = toml_table_in(post_toml, meta->posts[post_handle].slug);
 
     toml_datum_t title_toml = toml_string_in(post_i_toml, "title");
     if (!title_toml.ok) {
       PANIC("Failed to get title for post %s", meta->posts[post_handle].slug);
     }
-    meta->posts[post_handle].title = title_toml.u.s;
+    meta->posts[post_handle].title = arena_take(&meta->arena, title_toml.u.s);
 
     if (toml_key_exists(post_i_toml, "desc")) {
       toml_datum_t desc_toml = toml_string_in(post_i_toml, "desc");
       if (!desc_toml.ok) {
         PANIC("Failed to get desc for post %s", meta->posts[post_handle].slug);
       }
-      meta->posts[post_handle].desc = desc_toml.u.s;
+      meta->posts[post_handle].desc = arena_take(&meta->arena, desc_toml.u.s);
     } else {
       meta->posts[post_handle].desc = NULL;
     }
@@ -132,74 +227,52 @@ meta_t *meta_render(const toml_table_t *meta_toml) {
       meta->posts[post_handle].num_tags = toml_array_nelem(tags_toml);
     }
     meta->posts[post_handle].tag_handles =
-        malloc_panic(sizeof(uint32_t) * meta->posts[post_handle].num_tags);
+        arena_calloc(&meta->arena, meta->posts[post_handle].num_tags, sizeof(uint32_t));
     for (int itag = 0; itag < meta->posts[post_handle].num_tags; ++itag) {
       toml_datum_t tag_toml = toml_string_at(tags_toml, itag);
       if (!tag_toml.ok) {
         PANIC("Failed to get tag %d for post %s", itag, meta->posts[post_handle].slug);
       }
-      int tag_handle = meta_tag_handle(meta, tag_toml.u.s);
-      if (tag_handle == -1) {
-        tag_handle = meta_add_tag(meta, tag_toml.u.s);
-      } else {
-        free(tag_toml.u.s);
-      }
+      uint32_t tag_handle = meta_add_tag(meta, arena_take(&meta->arena, tag_toml.u.s));
       meta_add_tag_to_post(meta, post_handle, itag, tag_handle);
+      ++num_tag_refs;
     }
   }
   qsort(meta->posts, meta->num_posts, sizeof(meta_post_t), meta_post_date_cmp);
+  for (uint32_t i = 0; i < meta->num_posts; ++i) {
+    pthread_mutex_init(&meta->posts[i].lock, NULL); // after qsort, mutexes must not be moved
+  }
+  // post handles are indices into the sorted posts, so only now can tags point at them
+  meta_fill_tag_posts(meta, num_tag_refs);
+  meta_index_posts(meta);
   return meta;
 }
 
 meta_t *meta_parse(char *filename) {
-  FILE *fp = fopen(filename, "r");
-  if (fp == NULL) {
-    PANIC_ERRNO("Failed to open %s", filename);
-  }
+  file_view_t toml = map_file(filename);
   char errbuf[TOML_ERRBUF_SIZE];
-  toml_table_t *meta_toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
-  fclose(fp);
+  uint64_t start = prof_begin();
+  // toml_parse only reads the document, the parameter just predates const
+  toml_table_t *meta_toml = toml_parse((char *)toml.data, errbuf, sizeof(errbuf));
+  unmap_file(&toml);
   if (meta_toml == NULL) {
     PANIC("Failed to parse %s: %s", filename, errbuf);
   }
+  prof_end("meta", "toml", start);
+  start = prof_begin();
   meta_t *meta = meta_render(meta_toml);
   toml_free(meta_toml);
+  prof_end("meta", "model", start);
   return meta;
 }
 
 void meta_free(meta_t *meta) {
-  for (int i = 0; i < meta->num_posts; ++i) {
-    free(meta->posts[i].slug);
-    free(meta->posts[i].title);
-    if (meta->posts[i].desc != NULL) {
-      free(meta->posts[i].desc);
-    }
-    free(meta->posts[i].tag_handles);
-    if (meta->posts[i].content != NULL) {
-      free(meta->posts[i].content);
-    }
-    if (meta->posts[i].js != NULL) {
-      free(meta->posts[i].js);
-    }
-  }
-  free(meta->posts);
-
-  for (int i = 0; i < meta->num_tags; ++i) {
-    free(meta->tags[i].id);
-    free(meta->tags[i].post_handles);
-  }
-  free(meta->tags);
-
-  for (int i = 0; i < meta->num_pages; ++i) {
-    free(meta->pages[i]);
+  for (uint32_t i = 0; i < meta->num_posts; ++i) {
+    free(meta->posts[i].content);
+    pthread_mutex_destroy(&meta->posts[i].lock);
   }
-  free(meta->pages);
-
-  free(meta->site_name);
-  free(meta->site_url);
-  free(meta->site_desc);
-  free(meta->version);
-  free(meta);
+  arena_t arena = meta->arena; // meta itself is in the arena
+  arena_free(&arena);
 }
 
 void meta_debug(const meta_t *meta) {
@@ -211,6 +284,9 @@ void meta_debug(const meta_t *meta) {
     printf("%s ", meta->pages[i]);
   }
   printf("]\n");
+  if (meta->per_page > 0) {
+    printf("Posts per page: %u\n", meta->per_page);
+  }
   printf("Posts: %u\n", meta->num_posts);
   for (uint32_t i = 0; i < meta->num_posts; ++i) {
     printf("  %s: \"%s\" %s [ ", meta->posts[i].slug, meta->posts[i].title, meta->posts[i].date);
@@ -1,8 +1,10 @@
 #ifndef _SSG_META_H_
 #define _SSG_META_H_
 
+#include <pthread.h>
 #include <stdint.h>
 
+#include "arena.h"
 #include "toml.h"
 
 typedef struct {
@@ -10,10 +12,11 @@ typedef struct {
   char *title;
   char date[11]; // YYYY-MM-DD\0
   char *desc;
-  char *content;
+  char *content; // lazy loaded during template rendering, guarded by lock, malloc'd
   uint32_t *tag_handles;
   uint32_t num_tags;
-  char *js;
+  char *js; // script path, used if the script exists
+  pthread_mutex_t lock;
 } meta_post_t;
 
 typedef struct {
@@ -31,11 +34,26 @@ typedef struct {
   uint32_t num_posts;
   meta_tag_t *tags;
   uint32_t num_tags;
+  uint32_t *tag_index; // open addressing on the tag id, META_NO_TAG for empty slots
+  size_t tag_index_mask;
+  uint32_t *post_index; // open addressing on the post slug, META_NO_POST for empty slots
+  size_t post_index_mask;
   char **pages;
   uint32_t num_pages;
+  uint32_t per_page; // posts on each page of a listing, 0 to show them all on one page
+  arena_t arena; // owns meta and everything in it except post content
 } meta_t;
 
+#define META_NO_TAG UINT32_MAX
+#define META_NO_POST UINT32_MAX
+
 extern meta_t *meta_parse(char *filename);
+// Builds the model from an already parsed sausage.toml, which the caller still owns
+extern meta_t *meta_render(const toml_table_t *meta_toml);
+// Returns META_NO_TAG if there is no tag with that id
+extern uint32_t meta_tag_handle(const meta_t *meta, const char *id);
+// Returns META_NO_POST if there is no post with that slug
+extern uint32_t meta_post_handle(const meta_t *meta, const char *slug);
 extern void meta_free(meta_t *meta);
 extern void meta_debug(const meta_t *meta);
 
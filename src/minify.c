@@ -0,0 +1,383 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memmem
+#endif
+
+#include "minify.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "util.h"
+
+// Whitespace next to these is dropped in JS. Not < (it could start <!--), + - . or /
+#define JS_PUNCT "{}()[];,:=!&|?*%^~>"
+
+static bool g_minify_enabled = false;
+
+static const char *g_verbatim_tags[] = {"pre", "code", "textarea"};
+
+// A / after these keywords starts a regular expression
+static const char *g_regex_keywords[] = {
+    "return", "typeof", "instanceof", "in",   "of",    "new",  "delete",
+    "void",   "throw",  "case",       "do",   "else",  "yield", "await",
+};
+
+void minify_init(bool enabled) { g_minify_enabled = enabled; }
+
+bool minify_enabled(void) { return g_minify_enabled; }
+
+minify_kind_e minify_kind(const char *path) {
+  const char *base = strrchr(path, '/');
+  base = base != NULL ? base + 1 : path;
+  const char *ext = strrchr(base, '.');
+  if (ext == NULL || strstr(base, ".min.") != NULL) {
+    return MINIFY_NONE;
+  } else if (strcmp(ext, ".html") == 0) {
+    return MINIFY_HTML;
+  } else if (strcmp(ext, ".css") == 0) {
+    return MINIFY_CSS;
+  } else if (strcmp(ext, ".js") == 0 || strcmp(ext, ".mjs") == 0) {
+    return MINIFY_JS;
+  }
+  return MINIFY_NONE;
+}
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+static bool is_word(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '$' || c & 0x80;
+}
+
+static bool in_set(char c, const char *set) { return c != '\0' && strchr(set, c) != NULL; }
+
+/*
+ * All passes write dst[w] while reading src[r] with w <= r, so dst may be src. Nothing may be read
+ * back from src below r once it has been passed.
+ */
+
+// Copies the quoted string at src[r], returns the index after it
+static size_t copy_string(char *dst, size_t *w, const char *src, size_t r, size_t length,
+                          bool escapes) {
+  char quote = src[r];
+  dst[(*w)++] = src[r++];
+  while (r < length) {
+    char c = src[r];
+    dst[(*w)++] = src[r++];
+    if (escapes && c == '\\' && r < length) {
+      dst[(*w)++] = src[r++];
+    } else if (c == quote) {
+      break;
+    }
+  }
+  return r;
+}
+
+// Copies the JS template literal at src[r] verbatim, including any nested in its ${} expressions
+static size_t copy_template(char *dst, size_t *w, const char *src, size_t r, size_t length) {
+  dst[(*w)++] = src[r++];
+  uint32_t depth = 0; // braces open inside ${}
+  bool dollar = false;
+  while (r < length) {
+    char c = src[r];
+    if (depth > 0 && (c == '"' || c == '\'')) {
+      r = copy_string(dst, w, src, r, length, true);
+      continue;
+    } else if (depth > 0 && c == '`') {
+      r = copy_template(dst, w, src, r, length);
+      continue;
+    }
+    dst[(*w)++] = src[r++];
+    if (c == '\\' && r < length) {
+      dst[(*w)++] = src[r++];
+    } else if (c == '`' && depth == 0) {
+      break;
+    } else if (c == '{' && (depth > 0 || dollar)) {
+      ++depth;
+    } else if (c == '}' && depth > 0) {
+      --depth;
+    }
+    dollar = c == '$';
+  }
+  return r;
+}
+
+// Copies the regular expression at src[r], stopping at a line break if it was a division after all
+static size_t copy_regex(char *dst, size_t *w, const char *src, size_t r, size_t length) {
+  bool in_class = false;
+  dst[(*w)++] = src[r++];
+  while (r < length && src[r] != '\n') {
+    char c = src[r];
+    dst[(*w)++] = src[r++];
+    if (c == '\\' && r < length) {
+      dst[(*w)++] = src[r++];
+    } else if (c == '[') {
+      in_class = true;
+    } else if (c == ']') {
+      in_class = false;
+    } else if (c == '/' && !in_class) {
+      break;
+    }
+  }
+  return r;
+}
+
+// Whether a / after dst[0..w) starts a regular expression. Guessing wrong towards a regular
+// expression only copies the rest of the line verbatim, the other way round would mangle it.
+static bool regex_allowed(const char *dst, size_t w) {
+  if (w == 0) {
+    return true;
+  }
+  char prev = dst[w - 1];
+  if (prev == ')' || prev == ']') {
+    return false;
+  } else if (!is_word(prev)) {
+    return true;
+  }
+  size_t start = w;
+  while (start > 0 && is_word(dst[start - 1])) {
+    --start;
+  }
+  for (size_t i = 0; i < arrlen(g_regex_keywords); ++i) {
+    if (strlen(g_regex_keywords[i]) == w - start &&
+        memcmp(g_regex_keywords[i], dst + start, w - start) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static size_t comment_end(const char *src, size_t r, size_t length, const char *end) {
+  const char *found = memmem(src + r, length - r, end, strlen(end));
+  return found != NULL ? (size_t)(found - src) + strlen(end) : length;
+}
+
+static size_t minify_css_to(char *dst, const char *src, size_t length) {
+  size_t w = 0;
+  bool space = false;
+  for (size_t r = 0; r < length;) {
+    char c = src[r];
+    if (c == '/' && r + 1 < length && src[r + 1] == '*') {
+      r = comment_end(src, r + 2, length, "*/");
+      space = true; // a comment still separates tokens
+      continue;
+    } else if (is_space(c)) {
+      space = true;
+      ++r;
+      continue;
+    }
+    if (space && w > 0 && !in_set(dst[w - 1], "{};,>:") && !in_set(c, "{};,>")) {
+      dst[w++] = ' ';
+    }
+    space = false;
+    if (c == '"' || c == '\'') {
+      r = copy_string(dst, &w, src, r, length, true);
+      continue;
+    }
+    if (c == '}' && w > 0 && dst[w - 1] == ';') {
+      --w;
+    }
+    dst[w++] = c;
+    ++r;
+  }
+  return w;
+}
+
+static size_t minify_js_to(char *dst, const char *src, size_t length) {
+  size_t w = 0;
+  bool space = false, newline = false;
+  for (size_t r = 0; r < length;) {
+    char c = src[r];
+    if (c == '/' && r + 1 < length && src[r + 1] == '/') {
+      while (r < length && src[r] != '\n') {
+        ++r;
+      }
+      space = true;
+      continue;
+    } else if (c == '/' && r + 1 < length && src[r + 1] == '*') {
+      size_t end = comment_end(src, r + 2, length, "*/");
+      newline |= memchr(src + r, '\n', end - r) != NULL;
+      space = true;
+      r = end;
+      continue;
+    } else if (is_space(c)) {
+      space = true;
+      newline |= c == '\n';
+      ++r;
+      continue;
+    }
+    bool regex = c == '/' && regex_allowed(dst, w);
+    if (space && w > 0) {
+      char prev = dst[w - 1];
+      if (newline) {
+        // a line break can end a statement, except where one cannot end or must already have
+        if (!in_set(prev, "{;,([") && !in_set(c, "})];,")) {
+          dst[w++] = '\n';
+        }
+      } else if (prev == '<' || c == '<' || (!in_set(prev, JS_PUNCT) && !in_set(c, JS_PUNCT))) {
+        dst[w++] = ' ';
+      }
+    }
+    space = newline = false;
+    if (c == '"' || c == '\'') {
+      r = copy_string(dst, &w, src, r, length, true);
+    } else if (c == '`') {
+      r = copy_template(dst, &w, src, r, length);
+    } else if (regex) {
+      r = copy_regex(dst, &w, src, r, length);
+    } else {
+      dst[w++] = c;
+      ++r;
+    }
+  }
+  return w;
+}
+
+// Returns the index after the tag at src[r]
+static size_t tag_end(const char *src, size_t r, size_t length) {
+  while (r < length) {
+    char c = src[r++];
+    if (c == '"' || c == '\'') {
+      const char *quote = memchr(src + r, c, length - r);
+      r = quote != NULL ? (size_t)(quote - src) + 1 : length;
+    } else if (c == '>') {
+      break;
+    }
+  }
+  return r;
+}
+
+static void copy_tag(char *dst, size_t *w, const char *src, size_t r, size_t end) {
+  bool space = false;
+  while (r < end) {
+    char c = src[r];
+    if (is_space(c)) {
+      space = true;
+      ++r;
+      continue;
+    }
+    if (space && !(c == '>' && (dst[*w - 1] == '"' || dst[*w - 1] == '\''))) {
+      dst[(*w)++] = ' ';
+    }
+    space = false;
+    if (c == '"' || c == '\'') {
+      r = copy_string(dst, w, src, r, end, false);
+    } else {
+      dst[(*w)++] = c;
+      ++r;
+    }
+  }
+}
+
+static bool tag_named(const char *name, size_t length, const char *tag) {
+  return strlen(tag) == length && strncasecmp(name, tag, length) == 0;
+}
+
+static bool span_has(const char *src, size_t r, size_t end, const char *needle) {
+  size_t n = strlen(needle);
+  for (; r + n <= end; ++r) {
+    if (strncasecmp(src + r, needle, n) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the index of the </name that closes a raw text element
+static size_t raw_text_end(const char *src, size_t r, size_t length, const char *name) {
+  size_t n = strlen(name);
+  for (; r + n + 2 <= length; ++r) {
+    if (src[r] == '<' && src[r + 1] == '/' && strncasecmp(src + r + 2, name, n) == 0) {
+      return r;
+    }
+  }
+  return length;
+}
+
+static size_t minify_html_to(char *dst, const char *src, size_t length) {
+  size_t w = 0;
+  bool space = false;
+  for (size_t r = 0; r < length;) {
+    char c = src[r];
+    if (c == '<' && r + 4 <= length && memcmp(src + r, "<!--", 4) == 0) {
+      r = comment_end(src, r + 4, length, "-->");
+      continue;
+    } else if (is_space(c)) {
+      space = true;
+      ++r;
+      continue;
+    }
+    if (space && w > 0) {
+      dst[w++] = ' ';
+    }
+    space = false;
+    bool closing = r + 1 < length && src[r + 1] == '/';
+    if (c != '<' || r + 1 + closing >= length ||
+        !(isalpha((unsigned char)src[r + 1 + closing]) || src[r + 1] == '!')) {
+      dst[w++] = c;
+      ++r;
+      continue;
+    }
+
+    // look at the tag before copying it over itself
+    size_t name = r + 1 + closing, name_length = 0;
+    while (name + name_length < length && isalnum((unsigned char)src[name + name_length])) {
+      ++name_length;
+    }
+    size_t end = tag_end(src, r, length);
+    bool self_closing = end >= 2 && src[end - 2] == '/';
+    /*
+     * script and style contents are raw text, and pre, code and textarea contents are kept byte for
+     * byte, comments and tags included. Each runs up to its closing tag whatever is in it.
+     */
+    const char *raw_name = NULL;
+    minify_kind_e raw = MINIFY_NONE;
+    for (size_t i = 0; !closing && !self_closing && i < arrlen(g_verbatim_tags); ++i) {
+      if (tag_named(src + name, name_length, g_verbatim_tags[i])) {
+        raw_name = g_verbatim_tags[i];
+      }
+    }
+    if (!closing && tag_named(src + name, name_length, "script")) {
+      raw_name = "script";
+      // only scripts that are JS, not data or templates in a <script type="...">
+      if (!span_has(src, r, end, "type=") || span_has(src, r, end, "javascript") ||
+          span_has(src, r, end, "module")) {
+        raw = MINIFY_JS;
+      }
+    } else if (!closing && tag_named(src + name, name_length, "style")) {
+      raw_name = "style";
+      raw = MINIFY_CSS;
+    }
+    size_t raw_end = raw_name != NULL ? raw_text_end(src, end, length, raw_name) : end;
+
+    copy_tag(dst, &w, src, r, end);
+    r = end;
+    if (raw == MINIFY_JS) {
+      w += minify_js_to(dst + w, src + r, raw_end - r);
+    } else if (raw == MINIFY_CSS) {
+      w += minify_css_to(dst + w, src + r, raw_end - r);
+    } else {
+      memmove(dst + w, src + r, raw_end - r);
+      w += raw_end - r;
+    }
+    r = raw_end;
+  }
+  return w;
+}
+
+size_t minify(minify_kind_e kind, char *data, size_t length) {
+  switch (kind) {
+  case MINIFY_HTML:
+    return minify_html_to(data, data, length);
+  case MINIFY_CSS:
+    return minify_css_to(data, data, length);
+  case MINIFY_JS:
+    return minify_js_to(data, data, length);
+  case MINIFY_NONE:
+    break;
+  }
+  return length;
+}
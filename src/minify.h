@@ -0,0 +1,32 @@
+#ifndef _SSG_MINIFY_H_
+#define _SSG_MINIFY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Conservative whitespace and comment stripping for HTML, CSS and JS. Each pass works in place in
+ * a single sweep, since the output is never longer than the input, and returns the new length.
+ *
+ * HTML: whitespace runs become one space, comments are dropped, <pre>, <code> and <textarea> are
+ *       kept verbatim, inline <script> and <style> go through the JS and CSS passes.
+ * CSS:  comments are dropped, whitespace around { } ; , > and after : is removed.
+ * JS:   comments are dropped, whitespace next to punctuation is removed and line breaks are kept
+ *       wherever automatic semicolon insertion could depend on them. Strings, template literals and
+ *       regular expressions are copied untouched.
+ */
+
+typedef enum {
+  MINIFY_NONE,
+  MINIFY_HTML,
+  MINIFY_CSS,
+  MINIFY_JS,
+} minify_kind_e;
+
+extern void minify_init(bool enabled);
+extern bool minify_enabled(void);
+// The pass for path by its extension, MINIFY_NONE for other files and for *.min.* files
+extern minify_kind_e minify_kind(const char *path);
+extern size_t minify(minify_kind_e kind, char *data, size_t length);
+
+#endif
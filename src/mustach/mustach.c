@@ -20,6 +20,7 @@
 #endif
 
 #include "mustach.h"
+#include "../hescape/hescape.h"
 
 struct param {
   const char *arg_name;
@@ -42,6 +43,9 @@ struct iwrap {
   int flags;
   struct param params[MUSTACH_MAX_PARAMS];
   int nparams;
+  struct mustach_prog *prog; /* program being compiled or NULL when rendering */
+  int dry;                   /* count of compile passes whose output is discarded */
+  int cdepth;                /* nesting of process while compiling */
 };
 
 struct prefix {
@@ -50,6 +54,205 @@ struct prefix {
   struct prefix *prefix;
 };
 
+/*
+ * A compiled template is a flat array of instructions. Literals and names
+ * are stored in a single text pool so the program owns all its data.
+ */
+enum { OP_TEXT, OP_PUT, OP_SECTION, OP_END };
+
+struct mustach_op {
+  unsigned type : 2, escape : 1, inverted : 1;
+  size_t name; /* offset in text of the literal or of the zero terminated name */
+  size_t arg;  /* length of the literal or index of the jump target */
+  size_t pend, npend; /* literal emitted when OP_SECTION skips its body or OP_END loops */
+};
+
+struct mustach_prog {
+  struct mustach_op *ops;
+  size_t nops, aops;
+  char *text;
+  size_t ntext, atext;
+  size_t barrier; /* literals can't be merged in ops before that index */
+};
+
+/* the part of the state of process that determines what is emitted next */
+struct cstate {
+  int stdalone;
+  struct prefix pref;
+};
+
+static int prog_add_op(struct mustach_prog *prog, unsigned type, size_t name, size_t arg) {
+  struct mustach_op *ops;
+  size_t aops;
+
+  if (prog->nops == prog->aops) {
+    aops = prog->aops ? 2 * prog->aops : 64;
+    ops = realloc(prog->ops, aops * sizeof *ops);
+    if (ops == NULL)
+      return MUSTACH_ERROR_SYSTEM;
+    prog->ops = ops;
+    prog->aops = aops;
+  }
+  ops = &prog->ops[prog->nops++];
+  ops->type = type;
+  ops->escape = ops->inverted = 0;
+  ops->name = name;
+  ops->arg = arg;
+  ops->pend = ops->npend = 0;
+  return MUSTACH_OK;
+}
+
+static int prog_add_text(struct mustach_prog *prog, const char *buffer, size_t size,
+                         size_t *offset) {
+  char *text;
+  size_t atext;
+
+  if (prog->ntext + size > prog->atext) {
+    atext = prog->atext ? prog->atext : 1024;
+    while (atext < prog->ntext + size)
+      atext *= 2;
+    text = realloc(prog->text, atext);
+    if (text == NULL)
+      return MUSTACH_ERROR_SYSTEM;
+    prog->text = text;
+    prog->atext = atext;
+  }
+  memcpy(&prog->text[prog->ntext], buffer, size);
+  *offset = prog->ntext;
+  prog->ntext += size;
+  return MUSTACH_OK;
+}
+
+static int prog_literal(struct mustach_prog *prog, const char *buffer, size_t size) {
+  struct mustach_op *last;
+  size_t offset;
+  int rc;
+
+  if (size == 0)
+    return MUSTACH_OK;
+  rc = prog_add_text(prog, buffer, size, &offset);
+  if (rc < 0)
+    return rc;
+  last = prog->nops > prog->barrier ? &prog->ops[prog->nops - 1] : NULL;
+  if (last && last->type == OP_TEXT && last->name + last->arg == offset) {
+    last->arg += size;
+    return MUSTACH_OK;
+  }
+  return prog_add_op(prog, OP_TEXT, offset, size);
+}
+
+static int prog_named(struct mustach_prog *prog, unsigned type, const char *name, size_t *index) {
+  size_t offset;
+  int rc;
+
+  rc = prog_add_text(prog, name, strlen(name) + 1, &offset);
+  if (rc >= 0)
+    rc = prog_add_op(prog, type, offset, 0);
+  if (rc >= 0 && index)
+    *index = prog->nops - 1;
+  return rc;
+}
+
+/* index of the next op as a jump target */
+static size_t prog_label(struct mustach_prog *prog) {
+  prog->barrier = prog->nops;
+  return prog->nops;
+}
+
+static size_t prefix_length(const struct prefix *prefix) {
+  return prefix ? prefix_length(prefix->prefix) + prefix->len : 0;
+}
+
+static char *prefix_copy(char *dest, const struct prefix *prefix) {
+  if (prefix) {
+    dest = prefix_copy(dest, prefix->prefix);
+    memcpy(dest, prefix->start, prefix->len);
+    dest += prefix->len;
+  }
+  return dest;
+}
+
+/* tells whether emitprefix would produce the same text for both prefixes */
+static int prefix_same(const struct prefix *a, const struct prefix *b) {
+  size_t length = prefix_length(a);
+  char *buffer;
+  int same;
+
+  if (length != prefix_length(b))
+    return 0;
+  if (length == 0)
+    return 1;
+  buffer = malloc(2 * length);
+  if (buffer == NULL)
+    return 0;
+  prefix_copy(buffer, a);
+  prefix_copy(buffer + length, b);
+  same = memcmp(buffer, buffer + length, length) == 0;
+  free(buffer);
+  return same;
+}
+
+/* tells whether process drops the line as standalone when it resumes at 'rest' with state s */
+static int cstate_standalone(const struct cstate *s, const char *rest, const char *end) {
+  if (s->stdalone != 2)
+    return 0;
+  while (rest != end && *rest != '\n' && isspace(*rest))
+    rest++;
+  return rest == end || *rest == '\n';
+}
+
+/*
+ * Tells whether process produces the same output when it resumes at 'rest'
+ * with either state. Either the rest of the line is blank and the line is
+ * dropped as standalone, or the pending prefixes are the same.
+ */
+static int cstate_same(const struct cstate *a, const struct cstate *b, const char *rest,
+                       const char *end) {
+  if (a->stdalone != b->stdalone)
+    return 0;
+  if (cstate_standalone(a, rest, end))
+    return 1;
+  return prefix_same(&a->pref, &b->pref) && prefix_same(a->pref.prefix, b->pref.prefix);
+}
+
+/*
+ * Gets the prefix that process emits before anything else when it resumes
+ * at 'rest' with state s, on a line that is not standalone. Past it the
+ * state is the one of an inline tag: nothing pending.
+ */
+static int pending_prefix(const struct cstate *s, const char *rest, const char *end,
+                          char **buffer, size_t *size) {
+  *buffer = NULL;
+  *size = 0;
+  /* a pending prefix only goes out with some text on the line */
+  if (s->stdalone == 0 && (rest == end || *rest == '\n'))
+    return MUSTACH_OK;
+  *size = prefix_length(&s->pref);
+  if (*size == 0)
+    return MUSTACH_OK;
+  *buffer = malloc(*size);
+  if (*buffer == NULL)
+    return MUSTACH_ERROR_SYSTEM;
+  prefix_copy(*buffer, &s->pref);
+  return MUSTACH_OK;
+}
+
+/* sets the literal that op emits when it skips or loops to the pending prefix */
+static int prog_pending(struct mustach_prog *prog, size_t op, const struct cstate *s,
+                        const char *rest, const char *end) {
+  char *buffer;
+  size_t size;
+  int rc;
+
+  rc = pending_prefix(s, rest, end, &buffer, &size);
+  if (rc >= 0 && size) {
+    rc = prog_add_text(prog, buffer, size, &prog->ops[op].pend);
+    prog->ops[op].npend = size;
+  }
+  free(buffer);
+  return rc;
+}
+
 #if !defined(NO_OPEN_MEMSTREAM)
 static FILE *memfile_open(char **buffer, size_t *size) { return open_memstream(buffer, size); }
 static void memfile_abort(FILE *file, char **buffer, size_t *size) {
@@ -139,39 +342,22 @@ static inline size_t sbuf_length(struct mustach_sbuf *sbuf) {
 }
 
 static int iwrap_emit(void *closure, const char *buffer, size_t size, int escape, FILE *file) {
-  size_t i, j, r;
+  unsigned char escaped[HESC_MAX_ESCAPED(512)];
+  size_t i, n, chunk;
 
   (void)closure; /* unused */
 
-  if (!escape)
-    return fwrite(buffer, 1, size, file) != size ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+  /* most values have nothing to escape and go out in one piece */
+  i = escape ? hesc_find((const uint8_t *)buffer, size, 0) : size;
+  if (i != 0 && fwrite(buffer, i, 1, file) != 1)
+    return MUSTACH_ERROR_SYSTEM;
 
-  r = i = 0;
   while (i < size) {
-    j = i;
-    while (j < size && buffer[j] != '<' && buffer[j] != '>' && buffer[j] != '&' && buffer[j] != '"')
-      j++;
-    if (j != i && fwrite(&buffer[i], j - i, 1, file) != 1)
+    chunk = size - i < 512 ? size - i : 512;
+    n = hesc_escape_html_into(escaped, (const uint8_t *)&buffer[i], chunk, 0);
+    if (fwrite(escaped, n, 1, file) != 1)
       return MUSTACH_ERROR_SYSTEM;
-    if (j < size) {
-      switch (buffer[j++]) {
-      case '<':
-        r = fwrite("&lt;", 4, 1, file);
-        break;
-      case '>':
-        r = fwrite("&gt;", 4, 1, file);
-        break;
-      case '&':
-        r = fwrite("&amp;", 5, 1, file);
-        break;
-      case '"':
-        r = fwrite("&quot;", 6, 1, file);
-        break;
-      }
-      if (r != 1)
-        return MUSTACH_ERROR_SYSTEM;
-    }
-    i = j;
+    i += chunk;
   }
   return MUSTACH_OK;
 }
@@ -220,13 +406,38 @@ static int iwrap_partial(void *closure, const char *name, struct mustach_sbuf *s
   return rc;
 }
 
+static int iwrap_text(struct iwrap *iwrap, const char *buffer, size_t size, FILE *file) {
+  if (iwrap->prog)
+    return iwrap->dry ? MUSTACH_OK : prog_literal(iwrap->prog, buffer, size);
+  return iwrap->emit(iwrap->closure, buffer, size, 0, file);
+}
+
 static int emitprefix(struct iwrap *iwrap, FILE *file, struct prefix *prefix) {
   if (prefix->prefix) {
     int rc = emitprefix(iwrap, file, prefix->prefix);
     if (rc < 0)
       return rc;
   }
-  return prefix->len ? iwrap->emit(iwrap->closure, prefix->start, prefix->len, 0, file) : 0;
+  return prefix->len ? iwrap_text(iwrap, prefix->start, prefix->len, file) : 0;
+}
+
+static int process(const char *template, size_t length, struct iwrap *iwrap, FILE *file,
+                   struct prefix *prefix);
+
+/* processes partials, parents and blocks, compiling them inline */
+static int subprocess(const char *template, size_t length, struct iwrap *iwrap, FILE *file,
+                      struct prefix *prefix) {
+  int rc;
+
+  if (!iwrap->prog)
+    return process(template, length, iwrap, file, prefix);
+  if (iwrap->cdepth == MUSTACH_MAX_DEPTH)
+    /* recursive partials can only be expanded at rendering */
+    return MUSTACH_ERROR_NOT_COMPILABLE;
+  iwrap->cdepth++;
+  rc = process(template, length, iwrap, file, prefix);
+  iwrap->cdepth--;
+  return rc;
 }
 
 static int process(const char *template, size_t length, struct iwrap *iwrap, FILE *file,
@@ -239,10 +450,16 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
     const char *name, *again;
     size_t length;
     unsigned type : 2, enabled : 1, entered : 1;
+    unsigned compiled : 1, inverted : 1, pass : 1;
+    size_t op;                /* compiling: index of the section op */
+    size_t loop;              /* compiling: index of the first op of the body */
+    struct cstate open, exit; /* compiling: states after the opening and the closing */
   } stack[MUSTACH_MAX_DEPTH];
   size_t oplen, cllen, len, l;
+  char *shown;
   int depth, rc, enabled, stdalone, iparam, nparams, type;
   struct prefix pref;
+  struct cstate state;
 
   pref.prefix = prefix;
   end = template + (length ? length : strlen(template));
@@ -264,7 +481,7 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
             if (rc < 0)
               return rc;
           }
-          rc = iwrap->emit(iwrap->closure, template, l, 0, file);
+          rc = iwrap_text(iwrap, template, l, file);
           if (rc < 0)
             return rc;
         }
@@ -383,6 +600,9 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
       break;
     case '=':
       /* defines delimiters */
+      if (iwrap->prog && depth)
+        /* loops would not restore the delimiters */
+        return MUSTACH_ERROR_NOT_COMPILABLE;
       if (len < 5 || beg[len - 1] != '=')
         return MUSTACH_ERROR_BAD_SEPARATORS;
       beg++;
@@ -410,7 +630,33 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
       if (depth == MUSTACH_MAX_DEPTH)
         return MUSTACH_ERROR_TOO_DEEP;
       rc = enabled;
-      if (rc) {
+      stack[depth].compiled = rc && iwrap->prog;
+      if (stack[depth].compiled) {
+        /* record the section and compile its body as if it is shown */
+        rc = prog_named(iwrap->prog, OP_SECTION, name, &stack[depth].op);
+        if (rc < 0)
+          return rc;
+        iwrap->prog->ops[stack[depth].op].inverted = c == '^';
+        stack[depth].inverted = c == '^';
+        stack[depth].pass = 0;
+        stack[depth].open.stdalone = stdalone;
+        stack[depth].open.pref = pref;
+        stack[depth].loop = stack[depth].op + 1;
+        if (stdalone == 2 && !cstate_standalone(&stack[depth].open, template, end)) {
+          /*
+           * inline at the start of a line: the indentation goes out once on
+           * entering, the body is compiled and loops with nothing pending
+           */
+          rc = emitprefix(iwrap, file, &pref);
+          if (rc < 0)
+            return rc;
+          stack[depth].loop = prog_label(iwrap->prog);
+          stdalone = 0;
+          pref.len = 0;
+          pref.prefix = NULL;
+        }
+        rc = c == '#';
+      } else if (rc) {
         rc = iwrap->enter(iwrap->closure, name);
         if (rc < 0)
           return rc;
@@ -431,6 +677,60 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
         return MUSTACH_ERROR_CLOSING;
       switch (type) {
       case 0: /* end section */
+        if (stack[depth].compiled) {
+          state.stdalone = stdalone;
+          state.pref = pref;
+          if (stack[depth].pass == 0) {
+            /*
+             * the shown body is compiled: a loop restarts standalone if the
+             * opening is, else from nothing pending once the pending prefix
+             * of the closing went out
+             */
+            if (!stack[depth].inverted) {
+              if (cstate_standalone(&stack[depth].open, stack[depth].again, end)
+                      ? !cstate_same(&state, &stack[depth].open, stack[depth].again, end)
+                      : cstate_standalone(&state, stack[depth].again, end))
+                return MUSTACH_ERROR_NOT_COMPILABLE;
+              rc = prog_add_op(iwrap->prog, OP_END, 0, stack[depth].loop);
+              if (rc >= 0 && !cstate_standalone(&state, stack[depth].again, end))
+                rc = prog_pending(iwrap->prog, iwrap->prog->nops - 1, &state, stack[depth].again,
+                                  end);
+              if (rc < 0)
+                return rc;
+            }
+            /* now scan the hidden body to check that it ends in the same state */
+            stack[depth].exit = state;
+            stack[depth].pass = 1;
+            stdalone = stack[depth].open.stdalone;
+            pref = stack[depth].open.pref;
+            enabled = 0;
+            iwrap->dry++;
+            template = stack[depth++].again;
+            break;
+          }
+          iwrap->dry--;
+          if (cstate_same(&state, &stack[depth].exit, template, end)) {
+            stdalone = stack[depth].exit.stdalone;
+            pref = stack[depth].exit.pref;
+          } else if (!cstate_standalone(&state, template, end) &&
+                     !cstate_standalone(&stack[depth].exit, template, end)) {
+            /* each way out emits its own pending prefix, then nothing is pending */
+            rc = pending_prefix(&stack[depth].exit, template, end, &shown, &l);
+            if (rc >= 0)
+              rc = prog_literal(iwrap->prog, shown, l);
+            free(shown);
+            if (rc >= 0)
+              rc = prog_pending(iwrap->prog, stack[depth].op, &state, template, end);
+            if (rc < 0)
+              return rc;
+            stdalone = 0;
+            pref.len = 0;
+            pref.prefix = NULL;
+          } else
+            return MUSTACH_ERROR_NOT_COMPILABLE;
+          iwrap->prog->ops[stack[depth].op].arg = prog_label(iwrap->prog);
+          goto pop_stack;
+        }
         rc = enabled && stack[depth].entered ? iwrap->next(iwrap->closure) : 0;
         if (rc < 0)
           return rc;
@@ -443,10 +743,13 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
         }
         break;
       case 1: /* end parent */
+        if (iwrap->dry)
+          /* the parent would be processed even in a hidden section */
+          return MUSTACH_ERROR_NOT_COMPILABLE;
         sbuf_reset(&sbuf);
         rc = iwrap->partial(iwrap->closure_partial, name, &sbuf);
         if (rc >= 0) {
-          rc = process(sbuf.value, sbuf_length(&sbuf), iwrap, file, &pref);
+          rc = subprocess(sbuf.value, sbuf_length(&sbuf), iwrap, file, &pref);
           sbuf_release(&sbuf);
         }
         if (rc < 0)
@@ -461,17 +764,20 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
           iwrap->params[iwrap->nparams].len = op - stack[depth].again;
           iwrap->nparams++;
         } else {
+          if (iwrap->dry)
+            /* the block would be processed even in a hidden section */
+            return MUSTACH_ERROR_NOT_COMPILABLE;
           for (iparam = 0; iparam < iwrap->nparams; iparam++) {
             if (memcmp(iwrap->params[iparam].arg_name, name, len) == 0) {
-              rc = process(iwrap->params[iparam].value, iwrap->params[iparam].len, iwrap, file,
-                           &pref);
+              rc = subprocess(iwrap->params[iparam].value, iwrap->params[iparam].len, iwrap, file,
+                              &pref);
               if (rc < 0)
                 return rc;
               break;
             }
           }
           if (iparam == iwrap->nparams) {
-            rc = process(stack[depth].again, op - stack[depth].again, iwrap, file, &pref);
+            rc = subprocess(stack[depth].again, op - stack[depth].again, iwrap, file, &pref);
             if (rc < 0)
               return rc;
           }
@@ -489,7 +795,7 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
         sbuf_reset(&sbuf);
         rc = iwrap->partial(iwrap->closure_partial, name, &sbuf);
         if (rc >= 0) {
-          rc = process(sbuf.value, sbuf_length(&sbuf), iwrap, file, &pref);
+          rc = subprocess(sbuf.value, sbuf_length(&sbuf), iwrap, file, &pref);
           sbuf_release(&sbuf);
         }
         if (rc < 0)
@@ -523,7 +829,12 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
       break;
     default:
       /* replacement */
-      if (enabled) {
+      if (enabled && iwrap->prog) {
+        rc = prog_named(iwrap->prog, OP_PUT, name, NULL);
+        if (rc < 0)
+          return rc;
+        iwrap->prog->ops[iwrap->prog->nops - 1].escape = c != '&';
+      } else if (enabled) {
         rc = iwrap->put(iwrap->closure_put, name, c != '&', file);
         if (rc < 0)
           return rc;
@@ -533,41 +844,52 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
   }
 }
 
-int mustach_file(const char *template, size_t length, const struct mustach_itf *itf, void *closure,
-                 int flags, FILE *file) {
-  int rc;
-  struct iwrap iwrap;
-
+static int iwrap_init(struct iwrap *iwrap, const struct mustach_itf *itf, void *closure,
+                      int flags) {
   /* check validity */
   if (!itf->enter || !itf->next || !itf->leave || (!itf->put && !itf->get))
     return MUSTACH_ERROR_INVALID_ITF;
 
   /* init wrap structure */
-  iwrap.closure = closure;
+  iwrap->closure = closure;
   if (itf->put) {
-    iwrap.put = itf->put;
-    iwrap.closure_put = closure;
+    iwrap->put = itf->put;
+    iwrap->closure_put = closure;
   } else {
-    iwrap.put = iwrap_put;
-    iwrap.closure_put = &iwrap;
+    iwrap->put = iwrap_put;
+    iwrap->closure_put = iwrap;
   }
   if (itf->partial) {
-    iwrap.partial = itf->partial;
-    iwrap.closure_partial = closure;
+    iwrap->partial = itf->partial;
+    iwrap->closure_partial = closure;
   } else if (itf->get) {
-    iwrap.partial = itf->get;
-    iwrap.closure_partial = closure;
+    iwrap->partial = itf->get;
+    iwrap->closure_partial = closure;
   } else {
-    iwrap.partial = iwrap_partial;
-    iwrap.closure_partial = &iwrap;
+    iwrap->partial = iwrap_partial;
+    iwrap->closure_partial = iwrap;
   }
-  iwrap.emit = itf->emit ? itf->emit : iwrap_emit;
-  iwrap.enter = itf->enter;
-  iwrap.next = itf->next;
-  iwrap.leave = itf->leave;
-  iwrap.get = itf->get;
-  iwrap.flags = flags;
-  iwrap.nparams = 0;
+  iwrap->emit = itf->emit ? itf->emit : iwrap_emit;
+  iwrap->enter = itf->enter;
+  iwrap->next = itf->next;
+  iwrap->leave = itf->leave;
+  iwrap->get = itf->get;
+  iwrap->flags = flags;
+  iwrap->nparams = 0;
+  iwrap->prog = NULL;
+  iwrap->dry = 0;
+  iwrap->cdepth = 0;
+  return MUSTACH_OK;
+}
+
+int mustach_file(const char *template, size_t length, const struct mustach_itf *itf, void *closure,
+                 int flags, FILE *file) {
+  int rc;
+  struct iwrap iwrap;
+
+  rc = iwrap_init(&iwrap, itf, closure, flags);
+  if (rc < 0)
+    return rc;
 
   /* process */
   rc = itf->start ? itf->start(closure) : 0;
@@ -578,6 +900,112 @@ int mustach_file(const char *template, size_t length, const struct mustach_itf *
   return rc;
 }
 
+int mustach_compile(const char *template, size_t length, const struct mustach_itf *itf,
+                    void *closure, int flags, struct mustach_prog **prog) {
+  int rc;
+  struct iwrap iwrap;
+
+  *prog = NULL;
+  if (!itf->partial)
+    return MUSTACH_ERROR_INVALID_ITF;
+  rc = iwrap_init(&iwrap, itf, closure, flags);
+  if (rc < 0)
+    return rc;
+  iwrap.prog = calloc(1, sizeof *iwrap.prog);
+  if (iwrap.prog == NULL)
+    return MUSTACH_ERROR_SYSTEM;
+  rc = process(template, length, &iwrap, NULL, NULL);
+  if (rc < 0)
+    mustach_prog_free(iwrap.prog);
+  else
+    *prog = iwrap.prog;
+  return rc;
+}
+
+static int run(const struct mustach_prog *prog, struct iwrap *iwrap, FILE *file) {
+  const struct mustach_op *op;
+  size_t pc;
+  int rc;
+
+  pc = 0;
+  while (pc < prog->nops) {
+    op = &prog->ops[pc];
+    switch (op->type) {
+    case OP_TEXT:
+      rc = iwrap->emit(iwrap->closure, &prog->text[op->name], op->arg, 0, file);
+      if (rc < 0)
+        return rc;
+      pc++;
+      break;
+    case OP_PUT:
+      rc = iwrap->put(iwrap->closure_put, &prog->text[op->name], op->escape, file);
+      if (rc < 0)
+        return rc;
+      pc++;
+      break;
+    case OP_SECTION:
+      rc = iwrap->enter(iwrap->closure, &prog->text[op->name]);
+      if (rc < 0)
+        return rc;
+      if (op->inverted ? rc : !rc) {
+        /* skip the body */
+        if (rc)
+          iwrap->leave(iwrap->closure);
+        if (op->npend) {
+          rc = iwrap->emit(iwrap->closure, &prog->text[op->pend], op->npend, 0, file);
+          if (rc < 0)
+            return rc;
+        }
+        pc = op->arg;
+      } else
+        pc++;
+      break;
+    case OP_END:
+      rc = iwrap->next(iwrap->closure);
+      if (rc < 0)
+        return rc;
+      if (rc) {
+        if (op->npend) {
+          rc = iwrap->emit(iwrap->closure, &prog->text[op->pend], op->npend, 0, file);
+          if (rc < 0)
+            return rc;
+        }
+        pc = op->arg;
+      } else {
+        iwrap->leave(iwrap->closure);
+        pc++;
+      }
+      break;
+    }
+  }
+  return MUSTACH_OK;
+}
+
+int mustach_prog_file(const struct mustach_prog *prog, const struct mustach_itf *itf,
+                      void *closure, FILE *file) {
+  int rc;
+  struct iwrap iwrap;
+
+  rc = iwrap_init(&iwrap, itf, closure, Mustach_With_NoExtensions);
+  if (rc < 0)
+    return rc;
+
+  rc = itf->start ? itf->start(closure) : 0;
+  if (rc == 0)
+    rc = run(prog, &iwrap, file);
+  if (itf->stop)
+    itf->stop(closure, rc);
+  return rc;
+}
+
+void mustach_prog_free(struct mustach_prog *prog) {
+  if (prog) {
+    free(prog->ops);
+    free(prog->text);
+    free(prog);
+  }
+}
+
 int mustach_fd(const char *template, size_t length, const struct mustach_itf *itf, void *closure,
                int flags, int fd) {
   int rc;
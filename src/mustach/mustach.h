@@ -9,7 +9,8 @@
 #ifndef _mustach_h_included_
 #define _mustach_h_included_
 
-struct mustach_sbuf; /* see below */
+struct mustach_sbuf;  /* see below */
+struct mustach_prog; /* see below */
 
 /**
  * Current version of mustach and its derivates
@@ -62,6 +63,7 @@ struct mustach_sbuf; /* see below */
 #define MUSTACH_ERROR_ITEM_NOT_FOUND -10
 #define MUSTACH_ERROR_PARTIAL_NOT_FOUND -11
 #define MUSTACH_ERROR_UNDEFINED_TAG -12
+#define MUSTACH_ERROR_NOT_COMPILABLE -13
 
 /*
  * You can use definition below for user specific error
@@ -260,4 +262,44 @@ extern int mustach_fd(const char *template, size_t length, const struct mustach_
 extern int mustach_mem(const char *template, size_t length, const struct mustach_itf *itf,
                        void *closure, int flags, char **result, size_t *size);
 
+/**
+ * mustach_compile - Compiles the mustache 'template' into a program that
+ * renders like 'mustach_file' without scanning the template again.
+ *
+ * Partials, parents and blocks are resolved once through 'itf->partial', which
+ * is mandatory, and inlined in the program. Sections become conditional jumps
+ * whose names are given to 'enter' at rendering. 'closure' is only passed to
+ * 'partial'.
+ *
+ * @template: the template string to compile
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to 'partial'
+ * @prog:     the pointer receiving the program when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error. MUSTACH_ERROR_NOT_COMPILABLE is
+ * returned for the rare templates whose whitespace handling depends on the
+ * data (for example a section closed in the middle of an indented line);
+ * those can still be rendered with 'mustach_file'.
+ */
+extern int mustach_compile(const char *template, size_t length, const struct mustach_itf *itf,
+                           void *closure, int flags, struct mustach_prog **prog);
+
+/**
+ * mustach_prog_file - Renders the compiled 'prog' in 'file' for 'itf' and 'closure'.
+ *
+ * The program is not modified and can be rendered by several threads at once.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_prog_file(const struct mustach_prog *prog, const struct mustach_itf *itf,
+                             void *closure, FILE *file);
+
+/**
+ * mustach_prog_free - Releases a program returned by 'mustach_compile'.
+ */
+extern void mustach_prog_free(struct mustach_prog *prog);
+
 #endif
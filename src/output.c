@@ -0,0 +1,352 @@
+#include "output.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compress.h"
+#include "conf.h"
+#include "util.h"
+
+#define OUTPUT_MANIFEST_HEADER "sausage outputs 2\n"
+
+typedef struct {
+  char *path; // NULL if the slot is empty
+  uint64_t hash;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  bool produced; // by the current full build, or for an asset by the current static sync
+  bool asset;    // a fingerprinted copy, which the static sync writes instead of a build
+} output_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  output_t *slots; // open addressing on the path
+  size_t num_outputs;
+  size_t mask;
+  bool full;
+  bool dirty; // the manifest on disk is out of date
+  size_t written;
+  size_t unchanged;
+} output_map_t;
+
+static output_map_t g_outputs = {.lock = PTHREAD_MUTEX_INITIALIZER};
+// mkstemp() creates files only the owner can read, outputs get the mode open() would give them
+static mode_t g_file_mode = 0644;
+
+static output_t *output_slot(output_t *slots, size_t mask, const char *path) {
+  for (size_t i = hash_bytes(path, strlen(path)) & mask;; i = (i + 1) & mask) {
+    if (slots[i].path == NULL || strcmp(slots[i].path, path) == 0) {
+      return &slots[i];
+    }
+  }
+}
+
+// Rehashes the outputs that are kept into a table with room for twice as many
+static void outputs_rehash(size_t capacity, bool keep_unproduced) {
+  output_t *slots = calloc(capacity, sizeof(output_t));
+  if (slots == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+  g_outputs.num_outputs = 0;
+  for (size_t i = 0; g_outputs.mask && i <= g_outputs.mask; ++i) {
+    output_t *output = &g_outputs.slots[i];
+    if (output->path == NULL) {
+      continue;
+    } else if (!keep_unproduced && !output->produced) {
+      free(output->path);
+      continue;
+    }
+    *output_slot(slots, capacity - 1, output->path) = *output;
+    ++g_outputs.num_outputs;
+  }
+  free(g_outputs.slots);
+  g_outputs.slots = slots;
+  g_outputs.mask = capacity - 1;
+}
+
+// Returns the entry of path, a new one if there is none, call with the lock held
+static output_t *output_entry(const char *path) {
+  if (2 * (g_outputs.num_outputs + 1) > g_outputs.mask + 1) {
+    outputs_rehash(g_outputs.mask ? 2 * (g_outputs.mask + 1) : 64, true);
+  }
+  output_t *output = output_slot(g_outputs.slots, g_outputs.mask, path);
+  if (output->path == NULL) {
+    size_t length = strlen(path);
+    *output = (output_t){.path = malloc_panic(length + 1)};
+    memcpy(output->path, path, length + 1);
+    ++g_outputs.num_outputs;
+  }
+  return output;
+}
+
+void outputs_load(const char *manifest) {
+  // umask() can only be read by setting it, which is safe before the workers create files
+  mode_t mask = umask(0);
+  umask(mask);
+  g_file_mode = 0666 & ~mask;
+
+  FILE *fp = fopen(manifest, "r");
+  if (fp == NULL) {
+    if (errno != ENOENT) {
+      printf("Not using %s: %s\n", manifest, strerror(errno));
+    }
+    return;
+  }
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length = getline(&line, &capacity, fp);
+  if (length < 0 || strcmp(line, OUTPUT_MANIFEST_HEADER) != 0) {
+    printf("Not using %s: unknown format\n", manifest);
+    length = -1; // every output is written again and the manifest replaced
+  }
+  while (length >= 0 && (length = getline(&line, &capacity, fp)) > 0) {
+    unsigned long long hash;
+    long long size, mtime_sec, mtime_nsec;
+    char kind;
+    int path_offset;
+    if (line[length - 1] != '\n' ||
+        sscanf(line, "%llx %lld %lld %lld %c %n", &hash, &size, &mtime_sec, &mtime_nsec, &kind,
+               &path_offset) != 5 ||
+        (kind != 'p' && kind != 'a')) {
+      printf("Skipping malformed line in %s\n", manifest);
+      continue;
+    }
+    line[length - 1] = '\0';
+    output_t *output = output_entry(line + path_offset);
+    output->hash = hash;
+    output->size = size;
+    output->mtime_sec = mtime_sec;
+    output->mtime_nsec = mtime_nsec;
+    output->asset = kind == 'a';
+  }
+  free(line);
+  fclose(fp);
+}
+
+void outputs_begin(bool full) {
+  g_outputs.full = full;
+  g_outputs.written = 0;
+  g_outputs.unchanged = 0;
+  // assets are only copied once per session, so a rebuild must not count them as gone
+  for (size_t i = 0; g_outputs.mask && i <= g_outputs.mask; ++i) {
+    g_outputs.slots[i].produced &= g_outputs.slots[i].asset;
+  }
+}
+
+void outputs_begin_assets(void) {
+  for (size_t i = 0; g_outputs.mask && i <= g_outputs.mask; ++i) {
+    g_outputs.slots[i].produced &= !g_outputs.slots[i].asset;
+  }
+}
+
+void output_record_asset(const char *path) {
+  struct stat statbuf;
+  if (stat(path, &statbuf) != 0) {
+    return; // the copy failed and said so
+  }
+  pthread_mutex_lock(&g_outputs.lock);
+  output_t *output = output_entry(path);
+  output->produced = true;
+  output->asset = true;
+  if (output->size != statbuf.st_size || output->mtime_sec != statbuf.st_mtim.tv_sec ||
+      output->mtime_nsec != statbuf.st_mtim.tv_nsec) {
+    output->size = statbuf.st_size;
+    output->mtime_sec = statbuf.st_mtim.tv_sec;
+    output->mtime_nsec = statbuf.st_mtim.tv_nsec;
+    g_outputs.dirty = true;
+  }
+  pthread_mutex_unlock(&g_outputs.lock);
+}
+
+int output_temp(const char *path, char *tmp) {
+  int s = snprintf(tmp, MAX_PATH_LEN, "%s.XXXXXX", path);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  int fd = mkstemp(tmp);
+  if (fd >= 0 && fchmod(fd, g_file_mode) != 0) {
+    output_discard(fd, tmp);
+    return -1;
+  }
+  return fd;
+}
+
+bool output_replace(int fd, const char *tmp, const char *path) {
+  if (close(fd) != 0 || rename(tmp, path) != 0) {
+    int err = errno;
+    unlink(tmp);
+    errno = err;
+    return false;
+  }
+  return true;
+}
+
+void output_discard(int fd, const char *tmp) {
+  int err = errno;
+  close(fd);
+  unlink(tmp);
+  errno = err;
+}
+
+static void write_atomic(const char *path, const char *data, size_t length, struct stat *statbuf) {
+  char tmp[MAX_PATH_LEN];
+  int fd = output_temp(path, tmp);
+  if (fd < 0) {
+    PANIC_ERRNO("Failed to create a temporary file for %s", path);
+  }
+  // a single write for the whole page, unless the kernel takes it in pieces
+  if (!write_all(fd, data, length) || (statbuf != NULL && fstat(fd, statbuf) != 0)) {
+    output_discard(fd, tmp);
+    PANIC_ERRNO("Failed to write to file %s", tmp);
+  }
+  if (!output_replace(fd, tmp, path)) {
+    PANIC_ERRNO("Failed to replace %s", path);
+  }
+}
+
+bool output_write(const char *path, const char *data, size_t length, uint64_t hash) {
+  pthread_mutex_lock(&g_outputs.lock);
+  output_t *output = output_entry(path);
+  output->produced = true;
+  output_t recorded = *output;
+  pthread_mutex_unlock(&g_outputs.lock);
+
+  // the mtime tells whether anything but this build touched the page since
+  struct stat statbuf;
+  if (recorded.hash == hash && recorded.size == (int64_t)length && stat(path, &statbuf) == 0 &&
+      statbuf.st_size == recorded.size && statbuf.st_mtim.tv_sec == recorded.mtime_sec &&
+      statbuf.st_mtim.tv_nsec == recorded.mtime_nsec) {
+    pthread_mutex_lock(&g_outputs.lock);
+    ++g_outputs.unchanged;
+    pthread_mutex_unlock(&g_outputs.lock);
+    return false;
+  }
+  write_atomic(path, data, length, &statbuf);
+
+  pthread_mutex_lock(&g_outputs.lock);
+  // the table may have grown in the meantime
+  output = output_entry(path);
+  output->hash = hash;
+  output->size = length;
+  output->mtime_sec = statbuf.st_mtim.tv_sec;
+  output->mtime_nsec = statbuf.st_mtim.tv_nsec;
+  g_outputs.dirty = true;
+  ++g_outputs.written;
+  pthread_mutex_unlock(&g_outputs.lock);
+  return true;
+}
+
+// Removes the directories above path that are left empty, up to OUTPUT_DIR
+static void remove_empty_dirs(const char *path) {
+  char dir[MAX_PATH_LEN];
+  snprintf(dir, sizeof(dir), "%s", path);
+  for (char *slash = strrchr(dir, '/'); slash != NULL; slash = strrchr(dir, '/')) {
+    *slash = '\0';
+    if (strcmp(dir, OUTPUT_DIR) == 0 || rmdir(dir) != 0) {
+      break; // ENOTEMPTY ends the walk as soon as a directory still has other outputs
+    }
+  }
+}
+
+static void outputs_prune(void) {
+  size_t removed = 0;
+  for (size_t i = 0; g_outputs.mask && i <= g_outputs.mask; ++i) {
+    output_t *output = &g_outputs.slots[i];
+    if (output->path != NULL && !output->produced) {
+      printf("  removing %s\n", output->path);
+      if (unlink(output->path) != 0 && errno != ENOENT) {
+        printf("Failed to remove %s: %s\n", output->path, strerror(errno));
+      }
+      compress_remove(output->path);
+      remove_empty_dirs(output->path);
+      ++removed;
+    }
+  }
+  if (removed > 0) {
+    outputs_rehash(g_outputs.mask + 1, false);
+    g_outputs.dirty = true;
+  }
+  printf("  %zu written, %zu unchanged, %zu removed\n", g_outputs.written, g_outputs.unchanged,
+         removed);
+}
+
+static int output_cmp(const void *a, const void *b) {
+  return strcmp(((const output_t *)a)->path, ((const output_t *)b)->path);
+}
+
+void outputs_finish(const char *manifest) {
+  if (g_outputs.full) {
+    outputs_prune();
+  } else if (g_outputs.written + g_outputs.unchanged > 0) {
+    printf("  %zu written, %zu unchanged\n", g_outputs.written, g_outputs.unchanged);
+  }
+  if (!g_outputs.dirty) {
+    return;
+  }
+  // sorted, so that the manifest is easy to diff
+  output_t *outputs = malloc_panic((g_outputs.num_outputs + 1) * sizeof(output_t));
+  size_t num_outputs = 0;
+  for (size_t i = 0; g_outputs.mask && i <= g_outputs.mask; ++i) {
+    if (g_outputs.slots[i].path != NULL) {
+      outputs[num_outputs++] = g_outputs.slots[i];
+    }
+  }
+  qsort(outputs, num_outputs, sizeof(output_t), output_cmp);
+
+  strbuf_t sb = {0};
+  strbuf_append_str(&sb, OUTPUT_MANIFEST_HEADER);
+  for (size_t i = 0; i < num_outputs; ++i) {
+    char line[MAX_PATH_LEN + 128];
+    int s = snprintf(line, sizeof(line), "%016llx %lld %lld %lld %c %s\n",
+                     (unsigned long long)outputs[i].hash, (long long)outputs[i].size,
+                     (long long)outputs[i].mtime_sec, (long long)outputs[i].mtime_nsec,
+                     outputs[i].asset ? 'a' : 'p', outputs[i].path);
+    if (s < 0 || s >= (int)sizeof(line)) {
+      PANIC("Failed to construct manifest entry for %s", outputs[i].path);
+    }
+    strbuf_append(&sb, line, s);
+  }
+  free(outputs);
+  // the manifest lives with the cache, which does not exist yet after a build with --no-cache
+  const char *slash = strrchr(manifest, '/');
+  if (slash != NULL) {
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - manifest), manifest);
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+      PANIC_ERRNO("Failed to make directory: %s", dir);
+    }
+  }
+  write_atomic(manifest, sb.data, sb.length, NULL);
+  strbuf_free(&sb);
+  g_outputs.dirty = false;
+}
+
+void outputs_free(void) {
+  for (size_t i = 0; g_outputs.mask && i <= g_outputs.mask; ++i) {
+    free(g_outputs.slots[i].path);
+  }
+  free(g_outputs.slots);
+  g_outputs.slots = NULL;
+  g_outputs.num_outputs = 0;
+  g_outputs.mask = 0;
+}
+
+bool write_if_changed(const char *path, const char *data, size_t length) {
+  struct stat statbuf;
+  if (stat(path, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+      (size_t)statbuf.st_size == length) {
+    file_view_t view = map_file(path);
+    bool same = memcmp(view.data, data, length) == 0;
+    unmap_file(&view);
+    if (same) {
+      return false;
+    }
+  }
+  write_atomic(path, data, length, NULL);
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef _SSG_OUTPUT_H_
+#define _SSG_OUTPUT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Rendered outputs are only written when their bytes change, and then through a temporary file
+ * and rename(), so readers never see a partial page and unchanged pages keep their mtime. The
+ * manifest in OUTPUT_MANIFEST records the hash, size and mtime of everything the last build
+ * wrote, along with the fingerprinted copies of static assets. The next build compares against it
+ * instead of reading the pages back, and removes the pages and copies it no longer produces.
+ */
+
+// Also reads the umask for the temporary files, so call it before writing any output
+extern void outputs_load(const char *manifest);
+// Starts a build; a full build renders every output, so afterwards the rest can be pruned
+extern void outputs_begin(bool full);
+// hash is hash_bytes() of data. Returns false if path already had exactly these bytes.
+extern bool output_write(const char *path, const char *data, size_t length, uint64_t hash);
+// Starts a static sync, after which the fingerprinted copies it did not record can be pruned
+extern void outputs_begin_assets(void);
+// Records the fingerprinted copy at path, so that a full build prunes it once it is not made again
+extern void output_record_asset(const char *path);
+// Prunes after a full build and saves the manifest if anything changed
+extern void outputs_finish(const char *manifest);
+extern void outputs_free(void);
+// Replaces path through a temporary file, unless it already holds exactly data
+extern bool write_if_changed(const char *path, const char *data, size_t length);
+
+/*
+ * For writers that fill the file themselves: a temporary file next to path, which replaces path
+ * in one rename() once it is complete. On failure errno tells why.
+ */
+
+// Stores the temporary name in tmp, of MAX_PATH_LEN bytes. Returns its descriptor, or -1.
+extern int output_temp(const char *path, char *tmp);
+// Closes fd and moves tmp over path, returns false and removes tmp if either fails
+extern bool output_replace(int fd, const char *tmp, const char *path);
+// Closes fd and removes tmp after a failed write, keeping errno
+extern void output_discard(int fd, const char *tmp);
+
+#endif
@@ -0,0 +1,215 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "prof.h"
+#include "util.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct {
+  pool_fn_t fn;
+  void *arg;
+} task_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  task_t *tasks; // ring buffer
+  uint32_t head;
+  uint32_t count;
+  uint32_t capacity;
+} deque_t;
+
+struct pool {
+  pthread_t *threads;
+  deque_t *deques;
+  uint32_t num_workers;
+  uint32_t next_deque; // round-robin cursor for tasks submitted from outside the pool
+  atomic_size_t queued;  // tasks sitting in a deque
+  atomic_size_t pending; // tasks submitted but not yet finished
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  bool stop;
+};
+
+typedef struct {
+  pool_t *pool;
+  uint32_t worker;
+} worker_arg_t;
+
+static _Thread_local pool_t *t_pool = NULL;
+static _Thread_local uint32_t t_worker = 0;
+
+static void deque_push_back(deque_t *deque, task_t task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    uint32_t capacity = deque->capacity * 2;
+    task_t *tasks = malloc_panic(capacity * sizeof(task_t));
+    for (uint32_t i = 0; i < deque->count; ++i) {
+      tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+    }
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->head = 0;
+    deque->capacity = capacity;
+  }
+  deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+  ++deque->count;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static bool deque_pop_back(deque_t *deque, task_t *task) {
+  pthread_mutex_lock(&deque->lock);
+  bool ok = deque->count > 0;
+  if (ok) {
+    --deque->count;
+    *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return ok;
+}
+
+static bool deque_steal_front(deque_t *deque, task_t *task) {
+  pthread_mutex_lock(&deque->lock);
+  bool ok = deque->count > 0;
+  if (ok) {
+    *task = deque->tasks[deque->head];
+    deque->head = (deque->head + 1) % deque->capacity;
+    --deque->count;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return ok;
+}
+
+static bool take_task(pool_t *pool, uint32_t worker, task_t *task) {
+  if (deque_pop_back(&pool->deques[worker], task)) {
+    return true;
+  }
+  for (uint32_t i = 1; i < pool->num_workers; ++i) {
+    if (deque_steal_front(&pool->deques[(worker + i) % pool->num_workers], task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *worker_main(void *arg) {
+  worker_arg_t *worker_arg = arg;
+  pool_t *pool = worker_arg->pool;
+  uint32_t worker = worker_arg->worker;
+  free(worker_arg);
+  t_pool = pool;
+  t_worker = worker;
+  prof_thread_name("worker", worker);
+
+  for (;;) {
+    task_t task;
+    if (take_task(pool, worker, &task)) {
+      atomic_fetch_sub(&pool->queued, 1);
+      task.fn(task.arg, worker);
+      if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+      }
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->queued) == 0 && !pool->stop) {
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    bool stop = pool->stop && atomic_load(&pool->queued) == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+pool_t *pool_new(uint32_t num_workers) {
+  if (num_workers == 0) {
+    PANIC("Thread pool needs at least one worker");
+  }
+  pool_t *pool = malloc_panic(sizeof(pool_t));
+  pool->num_workers = num_workers;
+  pool->next_deque = 0;
+  atomic_init(&pool->queued, 0);
+  atomic_init(&pool->pending, 0);
+  pool->stop = false;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  pool->deques = malloc_panic(num_workers * sizeof(deque_t));
+  for (uint32_t i = 0; i < num_workers; ++i) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].tasks = malloc_panic(DEQUE_INITIAL_CAPACITY * sizeof(task_t));
+    pool->deques[i].head = 0;
+    pool->deques[i].count = 0;
+    pool->deques[i].capacity = DEQUE_INITIAL_CAPACITY;
+  }
+
+  pool->threads = malloc_panic(num_workers * sizeof(pthread_t));
+  for (uint32_t i = 0; i < num_workers; ++i) {
+    worker_arg_t *worker_arg = malloc_panic(sizeof(worker_arg_t));
+    *worker_arg = (worker_arg_t){.pool = pool, .worker = i};
+    int err = pthread_create(&pool->threads[i], NULL, worker_main, worker_arg);
+    if (err) {
+      errno = err;
+      PANIC_ERRNO("Failed to start worker thread %u", i);
+    }
+  }
+  return pool;
+}
+
+void pool_submit(pool_t *pool, pool_fn_t fn, void *arg) {
+  uint32_t deque;
+  if (t_pool == pool) {
+    deque = t_worker;
+  } else {
+    deque = pool->next_deque;
+    pool->next_deque = (pool->next_deque + 1) % pool->num_workers;
+  }
+  // counted before the push, so that a thief taking the task never brings queued below zero
+  atomic_fetch_add(&pool->pending, 1);
+  atomic_fetch_add(&pool->queued, 1);
+  deque_push_back(&pool->deques[deque], (task_t){.fn = fn, .arg = arg});
+  pthread_mutex_lock(&pool->lock);
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (atomic_load(&pool->pending) > 0) {
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (uint32_t i = 0; i < pool->num_workers; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  for (uint32_t i = 0; i < pool->num_workers; ++i) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  free(pool->deques);
+  free(pool->threads);
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+uint32_t pool_num_workers(const pool_t *pool) { return pool->num_workers; }
@@ -0,0 +1,23 @@
+#ifndef _SSG_POOL_H_
+#define _SSG_POOL_H_
+
+#include <stdint.h>
+
+/*
+ * Work-stealing thread pool. Every worker owns a deque of tasks; it pops its own tasks from the
+ * back and steals from the front of other workers' deques once its own deque runs dry.
+ */
+
+typedef void (*pool_fn_t)(void *arg, uint32_t worker);
+
+typedef struct pool pool_t;
+
+extern pool_t *pool_new(uint32_t num_workers);
+// Tasks submitted from a worker go to that worker's deque, others are dealt out round-robin.
+extern void pool_submit(pool_t *pool, pool_fn_t fn, void *arg);
+// Blocks until every submitted task (including tasks submitted by tasks) has finished.
+extern void pool_wait(pool_t *pool);
+extern void pool_free(pool_t *pool);
+extern uint32_t pool_num_workers(const pool_t *pool);
+
+#endif
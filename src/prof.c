@@ -0,0 +1,233 @@
+#include "prof.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+#define PROF_PAGE_CATEGORY "page"
+#define PROF_SLOWEST 10
+
+typedef struct {
+  const char *category;
+  uint32_t name; // offset into the thread's names
+  uint64_t start;
+  uint64_t duration;
+} prof_event_t;
+
+typedef struct prof_thread {
+  uint32_t tid;
+  char name[32];
+  prof_event_t *events;
+  size_t num_events;
+  size_t max_events;
+  strbuf_t names;
+  struct prof_thread *next;
+} prof_thread_t;
+
+// Events of one category and name, for the summary
+typedef struct {
+  const char *category;
+  const char *name;
+  uint64_t total;
+  uint64_t max;
+  size_t count;
+} prof_phase_t;
+
+bool g_prof_enabled = false;
+
+static const char *g_prof_path = NULL;
+static uint64_t g_prof_epoch = 0;
+static pthread_mutex_t g_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static prof_thread_t *g_prof_threads = NULL;
+static uint32_t g_prof_num_threads = 0;
+static _Thread_local prof_thread_t *t_prof = NULL;
+
+uint64_t prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static prof_thread_t *prof_thread(void) {
+  if (t_prof == NULL) {
+    t_prof = calloc(1, sizeof(prof_thread_t));
+    if (t_prof == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    pthread_mutex_lock(&g_prof_lock);
+    t_prof->tid = g_prof_num_threads++;
+    t_prof->next = g_prof_threads;
+    g_prof_threads = t_prof;
+    pthread_mutex_unlock(&g_prof_lock);
+    snprintf(t_prof->name, sizeof(t_prof->name), "thread %u", t_prof->tid);
+  }
+  return t_prof;
+}
+
+void prof_init(const char *path) {
+  g_prof_path = path;
+  g_prof_epoch = prof_now();
+  g_prof_enabled = true;
+  prof_thread_name("main", UINT32_MAX);
+}
+
+void prof_thread_name(const char *name, uint32_t index) {
+  if (!g_prof_enabled) {
+    return;
+  }
+  prof_thread_t *thread = prof_thread();
+  if (index == UINT32_MAX) {
+    snprintf(thread->name, sizeof(thread->name), "%s", name);
+  } else {
+    snprintf(thread->name, sizeof(thread->name), "%s %u", name, index);
+  }
+}
+
+void prof_record(const char *category, const char *name, uint64_t start) {
+  uint64_t end = prof_now();
+  prof_thread_t *thread = prof_thread();
+  if (thread->num_events == thread->max_events) {
+    thread->max_events = thread->max_events ? 2 * thread->max_events : 1024;
+    thread->events = realloc(thread->events, thread->max_events * sizeof(prof_event_t));
+    if (thread->events == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+  }
+  thread->events[thread->num_events++] = (prof_event_t){
+      .category = category,
+      .name = thread->names.length,
+      .start = start,
+      .duration = end - start,
+  };
+  strbuf_append(&thread->names, name, strlen(name) + 1);
+}
+
+static void write_trace(FILE *fp) {
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", fp);
+  bool first = true;
+  for (prof_thread_t *thread = g_prof_threads; thread != NULL; thread = thread->next) {
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+            first ? "" : ",\n", thread->tid);
+    write_json_string(fp, thread->name);
+    fputs("}}", fp);
+    first = false;
+    for (size_t i = 0; i < thread->num_events; ++i) {
+      const prof_event_t *event = &thread->events[i];
+      fputs(",\n{\"name\":", fp);
+      write_json_string(fp, thread->names.data + event->name);
+      fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              event->category, thread->tid, (event->start - g_prof_epoch) / 1e3,
+              event->duration / 1e3);
+    }
+  }
+  fputs("\n]}\n", fp);
+}
+
+static int total_cmp(const void *a, const void *b) {
+  uint64_t x = ((const prof_phase_t *)a)->total, y = ((const prof_phase_t *)b)->total;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int phase_name_cmp(const void *a, const void *b) {
+  const prof_phase_t *x = a, *y = b;
+  int c = strcmp(x->category, y->category);
+  return c != 0 ? c : strcmp(x->name, y->name);
+}
+
+// Slowest pages one by one, everything else summed up by category and name
+static void print_summary(void) {
+  size_t num_events = 0;
+  for (prof_thread_t *thread = g_prof_threads; thread != NULL; thread = thread->next) {
+    num_events += thread->num_events;
+  }
+  prof_phase_t *pages = malloc_panic((num_events + 1) * sizeof(prof_phase_t));
+  prof_phase_t *phases = malloc_panic((num_events + 1) * sizeof(prof_phase_t));
+  size_t num_pages = 0, num_phases = 0;
+  for (prof_thread_t *thread = g_prof_threads; thread != NULL; thread = thread->next) {
+    for (size_t i = 0; i < thread->num_events; ++i) {
+      const prof_event_t *event = &thread->events[i];
+      prof_phase_t phase = {
+          .category = event->category,
+          .name = thread->names.data + event->name,
+          .total = event->duration,
+          .max = event->duration,
+          .count = 1,
+      };
+      if (strcmp(event->category, PROF_PAGE_CATEGORY) == 0) {
+        pages[num_pages++] = phase;
+      } else {
+        phases[num_phases++] = phase;
+      }
+    }
+  }
+
+  qsort(phases, num_phases, sizeof(prof_phase_t), phase_name_cmp);
+  size_t num_groups = 0;
+  for (size_t i = 0; i < num_phases; ++i) {
+    if (num_groups > 0 && phase_name_cmp(&phases[num_groups - 1], &phases[i]) == 0) {
+      prof_phase_t *group = &phases[num_groups - 1];
+      group->total += phases[i].total;
+      group->max = phases[i].max > group->max ? phases[i].max : group->max;
+      ++group->count;
+    } else {
+      phases[num_groups++] = phases[i];
+    }
+  }
+  qsort(phases, num_groups, sizeof(prof_phase_t), total_cmp);
+  qsort(pages, num_pages, sizeof(prof_phase_t), total_cmp);
+
+  printf("PROFILE\n  %-40s %12s %8s %12s\n", "phase", "total ms", "count", "max ms");
+  for (size_t i = 0; i < num_groups; ++i) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s: %s", phases[i].category, phases[i].name);
+    printf("  %-40s %12.3f %8zu %12.3f\n", name, phases[i].total / 1e6, phases[i].count,
+           phases[i].max / 1e6);
+  }
+  printf("  %-40s %12s\n", "slowest pages", "ms");
+  for (size_t i = 0; i < num_pages && i < PROF_SLOWEST; ++i) {
+    printf("  %-40s %12.3f\n", pages[i].name, pages[i].total / 1e6);
+  }
+  free(pages);
+  free(phases);
+}
+
+void prof_flush(void) {
+  size_t num_events = 0;
+  for (prof_thread_t *thread = g_prof_threads; thread != NULL; thread = thread->next) {
+    num_events += thread->num_events;
+  }
+  if (!g_prof_enabled || num_events == 0) {
+    return;
+  }
+  FILE *fp = fopen(g_prof_path, "w");
+  if (fp == NULL) {
+    PANIC_ERRNO("Failed to open %s", g_prof_path);
+  }
+  write_trace(fp);
+  if (fclose(fp) != 0) {
+    PANIC_ERRNO("Failed to write %s", g_prof_path);
+  }
+  print_summary();
+  printf("  trace written to %s\n", g_prof_path);
+
+  // the threads stay registered with their names, only their events go
+  for (prof_thread_t *thread = g_prof_threads; thread != NULL; thread = thread->next) {
+    thread->num_events = 0;
+    strbuf_reset(&thread->names);
+  }
+  g_prof_epoch = prof_now();
+}
+
+void prof_finish(void) {
+  prof_flush();
+  g_prof_enabled = false;
+  while (g_prof_threads != NULL) {
+    prof_thread_t *next = g_prof_threads->next;
+    free(g_prof_threads->events);
+    strbuf_free(&g_prof_threads->names);
+    free(g_prof_threads);
+    g_prof_threads = next;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef _SSG_PROF_H_
+#define _SSG_PROF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Scoped timings for --profile. Every thread records into its own buffer, and prof_flush writes
+ * them all as Chrome trace events (open in chrome://tracing or ui.perfetto.dev) and prints the
+ * slowest pages and phases. While profiling is off, a scope costs a load and a branch.
+ *
+ *   uint64_t start = prof_begin();
+ *   ...
+ *   prof_end("markdown", "parse", start);
+ */
+
+extern bool g_prof_enabled;
+
+extern void prof_init(const char *path);
+extern uint64_t prof_now(void);
+// name is copied, category must be a literal
+extern void prof_record(const char *category, const char *name, uint64_t start);
+// Names the calling thread in the trace
+extern void prof_thread_name(const char *name, uint32_t index);
+/*
+ * Writes the trace and prints the summary of the events since the last flush, then drops them, so
+ * that a long --watch or serve session keeps only one round of events. The trace file always holds
+ * the latest round. Call it while no other thread records.
+ */
+extern void prof_flush(void);
+// Flushes what is left and stops profiling
+extern void prof_finish(void);
+
+static inline uint64_t prof_begin(void) { return g_prof_enabled ? prof_now() : 0; }
+
+static inline void prof_end(const char *category, const char *name, uint64_t start) {
+  if (g_prof_enabled) {
+    prof_record(category, name, start);
+  }
+}
+
+#endif
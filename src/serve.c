@@ -0,0 +1,645 @@
+#include "serve.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "conf.h"
+#include "prof.h"
+#include "util.h"
+
+#define SERVE_MAX_EVENTS 64
+#define SERVE_MAX_REQUEST 8192
+#define SERVE_PROF_IDLE_MS 500
+
+typedef struct {
+  char *body; // NULL until first requested
+  size_t length;
+  uint64_t etag;
+} page_t;
+
+typedef struct {
+  int fd;
+  char in[SERVE_MAX_REQUEST];
+  size_t in_length;
+  char *out;
+  size_t out_length;
+  size_t out_offset;
+  size_t out_capacity;
+  int file_fd; // static file being sent after out, or -1
+  off_t file_offset;
+  off_t file_end;
+  bool close_after;
+} conn_t;
+
+typedef struct {
+  build_t *build;
+  int epfd;
+  // meta pages, then rss, then posts, then tags, then the later pages of paginated listings
+  page_t *pages;
+  size_t num_pages;
+  // page k > 1 of listing l, counting the meta pages then the tags, is in later_pages[l] + k - 2
+  size_t *later_pages; // one more entry than there are listings, so each listing has an end
+} server_t;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int sig) {
+  (void)sig;
+  g_stop = 1;
+}
+
+static const struct {
+  const char *ext;
+  const char *type;
+} g_content_types[] = {
+    {".html", "text/html; charset=utf-8"},
+    {".css", "text/css; charset=utf-8"},
+    {".js", "text/javascript; charset=utf-8"},
+    {".xml", "application/rss+xml; charset=utf-8"},
+    {".json", "application/json"},
+    {".txt", "text/plain; charset=utf-8"},
+    {".wasm", "application/wasm"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".ico", "image/x-icon"},
+    {".woff2", "font/woff2"},
+};
+
+static const char *content_type(const char *path) {
+  const char *ext = strrchr(path, '.');
+  if (ext != NULL && strchr(ext, '/') == NULL) {
+    for (size_t i = 0; i < arrlen(g_content_types); ++i) {
+      if (strcmp(ext, g_content_types[i].ext) == 0) {
+        return g_content_types[i].type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+// Matches path against "<prefix><name><suffix>" and returns whether name equals id
+static bool path_is(const char *path, const char *prefix, const char *id, const char *suffix) {
+  size_t p = strlen(prefix), i = strlen(id);
+  return strncmp(path, prefix, p) == 0 && strncmp(path + p, id, i) == 0 &&
+         strcmp(path + p + i, suffix) == 0;
+}
+
+// Pages of listing l (meta pages, then tags), 0 if it is not paginated
+static uint32_t listing_pages(const meta_t *meta, uint32_t l) {
+  if (l < meta->num_pages) {
+    return listing_num_pages(template_get(meta->pages[l]), meta, meta->num_posts);
+  }
+  return listing_num_pages(template_get("tag"), meta, meta->tags[l - meta->num_pages].num_posts);
+}
+
+// Matches "/<listing>/<k>.html" against the later pages of the paginated listings
+static int64_t route_later_page(const server_t *server, const char *path) {
+  const meta_t *meta = server->build->meta;
+  const char *last = strrchr(path, '/');
+  char *end;
+  if (last == path || last[1] < '0' || last[1] > '9') {
+    return -1;
+  }
+  unsigned long page = strtoul(last + 1, &end, 10);
+  if (strcmp(end, ".html") != 0 || page < 2) {
+    return -1;
+  }
+  char listing[MAX_PATH_LEN];
+  memcpy(listing, path, last - path);
+  listing[last - path] = '\0';
+  uint32_t l = META_NO_TAG;
+  for (uint32_t i = 0; i < meta->num_pages && l == META_NO_TAG; ++i) {
+    if (path_is(listing, "/", meta->pages[i], "")) {
+      l = i;
+    }
+  }
+  if (l == META_NO_TAG && strncmp(listing, "/tag/", 5) == 0) {
+    uint32_t tag_handle = meta_tag_handle(meta, listing + 5);
+    l = tag_handle != META_NO_TAG ? meta->num_pages + tag_handle : META_NO_TAG;
+  }
+  if (l == META_NO_TAG || page - 2 >= server->later_pages[l + 1] - server->later_pages[l]) {
+    return -1;
+  }
+  return server->later_pages[l] + page - 2;
+}
+
+// Returns the page slot serving path, or -1 if path is not a rendered page
+static int64_t route_page(const server_t *server, const char *path) {
+  const meta_t *meta = server->build->meta;
+  int64_t slot = 0;
+  for (uint32_t i = 0; i < meta->num_pages; ++i, ++slot) {
+    if (path_is(path, "/", meta->pages[i], ".html") ||
+        (strcmp(path, "/") == 0 && strcmp(meta->pages[i], "index") == 0)) {
+      return slot;
+    }
+  }
+  if (strcmp(path, "/rss.xml") == 0) {
+    return slot;
+  }
+  ++slot;
+  size_t length = strlen(path);
+  if (strncmp(path, "/post/", 6) == 0 && length > 11 && strcmp(path + length - 5, ".html") == 0) {
+    char slug[MAX_PATH_LEN];
+    memcpy(slug, path + 6, length - 11);
+    slug[length - 11] = '\0';
+    uint32_t post_handle = meta_post_handle(meta, slug);
+    if (post_handle != META_NO_POST) {
+      return slot + post_handle;
+    }
+  }
+  slot += meta->num_posts;
+  if (strncmp(path, "/tag/", 5) == 0 && length > 10 && strcmp(path + length - 5, ".html") == 0) {
+    char id[MAX_PATH_LEN];
+    memcpy(id, path + 5, length - 10);
+    id[length - 10] = '\0';
+    uint32_t tag_handle = meta_tag_handle(meta, id);
+    if (tag_handle != META_NO_TAG) {
+      return slot + tag_handle;
+    }
+  }
+  return route_later_page(server, path);
+}
+
+static page_t *get_page(server_t *server, size_t slot) {
+  page_t *page = &server->pages[slot];
+  if (page->body != NULL) {
+    return page;
+  }
+  meta_t *meta = server->build->meta;
+  closure_t *closure = &server->build->closures[0];
+  uint32_t num_listings = meta->num_pages + meta->num_tags;
+  uint32_t l = UINT32_MAX; // the listing, if the page is one
+  closure->page = 1;
+  if (slot >= server->later_pages[0]) {
+    // the last listing whose later pages start at or before slot
+    uint32_t lo = 0, hi = num_listings;
+    while (hi - lo > 1) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (server->later_pages[mid] <= slot) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    l = lo;
+    closure->page = slot - server->later_pages[l] + 2;
+  } else if (slot < meta->num_pages) {
+    l = slot;
+  } else if (slot > meta->num_pages + meta->num_posts) {
+    l = slot - 1 - meta->num_posts;
+  }
+
+  const template_t *tmpl;
+  char base[MAX_PATH_LEN] = "";
+  closure->state = ROOT;
+  closure->index = 0;
+  closure->index_inner = 0;
+  if (l < meta->num_pages) {
+    tmpl = template_get(meta->pages[l]);
+    snprintf(base, sizeof(base), "%s", meta->pages[l]);
+  } else if (l != UINT32_MAX) {
+    tmpl = template_get("tag");
+    closure->state = TAG;
+    closure->index = l - meta->num_pages;
+    snprintf(base, sizeof(base), "tag/%s", meta->tags[closure->index].id);
+  } else if (slot == meta->num_pages) {
+    tmpl = template_get("rss");
+  } else {
+    tmpl = template_get("post");
+    closure->state = POST;
+    closure->index = slot - meta->num_pages - 1;
+  }
+  closure->listing = closure->state;
+  closure->listing_slug = base;
+  closure->num_pages = l != UINT32_MAX ? listing_pages(meta, l) : 0;
+  if (closure->num_pages == 0) {
+    closure->page = 0;
+  }
+  page->body = render_string(closure, tmpl, &page->length);
+  page->etag = hash_bytes(page->body, page->length);
+  return page;
+}
+
+static void conn_append(conn_t *conn, const char *data, size_t length) {
+  if (conn->out_length + length > conn->out_capacity) {
+    size_t capacity = conn->out_capacity ? conn->out_capacity : 4096;
+    while (capacity < conn->out_length + length) {
+      capacity *= 2;
+    }
+    conn->out = realloc(conn->out, capacity);
+    if (conn->out == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    conn->out_capacity = capacity;
+  }
+  memcpy(conn->out + conn->out_length, data, length);
+  conn->out_length += length;
+}
+
+static void respond_head(conn_t *conn, int status, const char *reason, const char *type,
+                         size_t length, uint64_t etag) {
+  char head[512];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Server: sausage/%d.%d\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Cache-Control: no-cache\r\n"
+                   "Connection: %s\r\n",
+                   status, reason, SSG_VERSION_MAJOR, SSG_VERSION_MINOR, type, length,
+                   conn->close_after ? "close" : "keep-alive");
+  if (n < 0 || (size_t)n >= sizeof(head)) {
+    PANIC("Failed to format response header");
+  }
+  conn_append(conn, head, n);
+  if (etag != 0) {
+    n = snprintf(head, sizeof(head), "ETag: \"%016llx\"\r\n", (unsigned long long)etag);
+    conn_append(conn, head, n);
+  }
+  conn_append(conn, "\r\n", 2);
+}
+
+static void respond_error(conn_t *conn, int status, const char *reason, bool head_only) {
+  char body[128];
+  int n = snprintf(body, sizeof(body), "%d %s\n", status, reason);
+  respond_head(conn, status, reason, "text/plain; charset=utf-8", n, 0);
+  if (!head_only) {
+    conn_append(conn, body, n);
+  }
+}
+
+static bool etag_matches(const char *if_none_match, uint64_t etag) {
+  if (if_none_match == NULL) {
+    return false;
+  }
+  char tag[32];
+  snprintf(tag, sizeof(tag), "\"%016llx\"", (unsigned long long)etag);
+  return strstr(if_none_match, tag) != NULL || strncmp(if_none_match, "*", 1) == 0;
+}
+
+// Decodes %XX escapes and drops the query string, returns false for paths that leave the root
+static bool decode_path(const char *target, size_t length, char *path, size_t size) {
+  size_t n = 0;
+  for (size_t i = 0; i < length && target[i] != '?' && target[i] != '#'; ++i) {
+    char c = target[i];
+    if (c == '%' && i + 2 < length) {
+      char hex[3] = {target[i + 1], target[i + 2], '\0'};
+      char *end;
+      c = (char)strtol(hex, &end, 16);
+      if (*end != '\0' || c == '\0') {
+        return false;
+      }
+      i += 2;
+    }
+    if (n + 1 >= size) {
+      return false;
+    }
+    path[n++] = c;
+  }
+  path[n] = '\0';
+  return path[0] == '/' && strstr(path, "/..") == NULL;
+}
+
+static void serve_static(server_t *server, conn_t *conn, const char *path, bool head_only,
+                         const char *if_none_match) {
+  char fs_path[MAX_PATH_LEN];
+  int s;
+  if (strncmp(path, "/wasm/", 6) == 0) {
+    s = snprintf(fs_path, MAX_PATH_LEN, "%s/%s", server->build->wasmdir, path + 6);
+  } else {
+    s = snprintf(fs_path, MAX_PATH_LEN, STATIC_DIR "%s", path);
+  }
+  struct stat statbuf;
+  int fd = -1;
+  if (s > 0 && s < MAX_PATH_LEN) {
+    fd = open(fs_path, O_RDONLY | O_CLOEXEC);
+  }
+  if (fd < 0 || fstat(fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    respond_error(conn, 404, "Not Found", head_only);
+    return;
+  }
+  uint64_t stamp[2] = {(uint64_t)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec,
+                       (uint64_t)statbuf.st_size};
+  uint64_t etag = hash_bytes(stamp, sizeof(stamp));
+  if (etag_matches(if_none_match, etag)) {
+    close(fd);
+    respond_head(conn, 304, "Not Modified", content_type(path), 0, etag);
+    return;
+  }
+  respond_head(conn, 200, "OK", content_type(path), statbuf.st_size, etag);
+  if (head_only) {
+    close(fd);
+    return;
+  }
+  conn->file_fd = fd;
+  conn->file_offset = 0;
+  conn->file_end = statbuf.st_size;
+}
+
+static const char *header_value(const char *line, size_t length, const char *name) {
+  size_t n = strlen(name);
+  if (length <= n || strncasecmp(line, name, n) != 0 || line[n] != ':') {
+    return NULL;
+  }
+  const char *value = line + n + 1;
+  while (*value == ' ' || *value == '\t') {
+    ++value;
+  }
+  return value;
+}
+
+// Handles the request in conn->in[0, length), which ends in an empty line
+static void handle_request(server_t *server, conn_t *conn, size_t length) {
+  char *req = conn->in;
+  char *line_end = strstr(req, "\r\n");
+  char *method_end = memchr(req, ' ', line_end - req);
+  char *target_end = method_end ? memchr(method_end + 1, ' ', line_end - method_end - 1) : NULL;
+  if (target_end == NULL) {
+    conn->close_after = true;
+    respond_error(conn, 400, "Bad Request", false);
+    return;
+  }
+  char *target = method_end + 1;
+  bool http11 = strncmp(target_end + 1, "HTTP/1.1", 8) == 0;
+  bool keep_alive = http11;
+  const char *if_none_match = NULL;
+  for (char *line = line_end + 2; line < req + length - 2;) {
+    char *end = strstr(line, "\r\n");
+    *end = '\0';
+    const char *value;
+    if ((value = header_value(line, end - line, "Connection")) != NULL) {
+      if (strcasecmp(value, "close") == 0) {
+        keep_alive = false;
+      } else if (strcasecmp(value, "keep-alive") == 0) {
+        keep_alive = true;
+      }
+    } else if ((value = header_value(line, end - line, "If-None-Match")) != NULL) {
+      if_none_match = value;
+    }
+    line = end + 2;
+  }
+  conn->close_after = !keep_alive;
+
+  bool head_only = strncmp(req, "HEAD ", 5) == 0;
+  if (!head_only && strncmp(req, "GET ", 4) != 0) {
+    // the request may carry a body we don't read, so don't reuse the connection
+    conn->close_after = true;
+    respond_error(conn, 405, "Method Not Allowed", false);
+    return;
+  }
+  char path[MAX_PATH_LEN];
+  if (!decode_path(target, target_end - target, path, sizeof(path))) {
+    respond_error(conn, 400, "Bad Request", head_only);
+    return;
+  }
+
+  int64_t slot = route_page(server, path);
+  if (slot < 0) {
+    serve_static(server, conn, path, head_only, if_none_match);
+    return;
+  }
+  page_t *page = get_page(server, slot);
+  const char *type = content_type(strcmp(path, "/") == 0 ? "/index.html" : path);
+  if (etag_matches(if_none_match, page->etag)) {
+    respond_head(conn, 304, "Not Modified", type, 0, page->etag);
+    return;
+  }
+  respond_head(conn, 200, "OK", type, page->length, page->etag);
+  if (!head_only) {
+    conn_append(conn, page->body, page->length);
+  }
+}
+
+static void conn_close(conn_t *conn) {
+  if (conn->file_fd >= 0) {
+    close(conn->file_fd);
+  }
+  close(conn->fd); // also removes it from the epoll set
+  free(conn->out);
+  free(conn);
+}
+
+static void conn_want(server_t *server, conn_t *conn, uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.ptr = conn};
+  if (epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+    PANIC_ERRNO("Failed to update epoll interest");
+  }
+}
+
+// Flushes pending output and handles buffered requests until the socket would block
+static void conn_drive(server_t *server, conn_t *conn) {
+  for (;;) {
+    while (conn->out_offset < conn->out_length) {
+      ssize_t n =
+          write(conn->fd, conn->out + conn->out_offset, conn->out_length - conn->out_offset);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          conn_want(server, conn, EPOLLOUT);
+          return;
+        } else if (errno == EINTR) {
+          continue;
+        }
+        conn_close(conn);
+        return;
+      }
+      conn->out_offset += n;
+    }
+    while (conn->file_fd >= 0 && conn->file_offset < conn->file_end) {
+      ssize_t n = sendfile(conn->fd, conn->file_fd, &conn->file_offset,
+                           conn->file_end - conn->file_offset);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        conn_want(server, conn, EPOLLOUT);
+        return;
+      } else if (n <= 0) {
+        conn_close(conn);
+        return;
+      }
+    }
+    if (conn->file_fd >= 0) {
+      close(conn->file_fd);
+      conn->file_fd = -1;
+    }
+    conn->out_length = 0;
+    conn->out_offset = 0;
+    if (conn->close_after) {
+      conn_close(conn);
+      return;
+    }
+
+    char *end = conn->in_length > 0 ? strstr(conn->in, "\r\n\r\n") : NULL;
+    if (end == NULL) {
+      if (conn->in_length == SERVE_MAX_REQUEST - 1) {
+        conn->close_after = true;
+        respond_error(conn, 431, "Request Header Fields Too Large", false);
+        continue;
+      }
+      conn_want(server, conn, EPOLLIN);
+      return;
+    }
+    size_t length = end + 4 - conn->in;
+    char next = conn->in[length];
+    conn->in[length] = '\0';
+    handle_request(server, conn, length);
+    conn->in[length] = next;
+    memmove(conn->in, conn->in + length, conn->in_length - length + 1);
+    conn->in_length -= length;
+  }
+}
+
+static void conn_read(server_t *server, conn_t *conn) {
+  while (conn->in_length < SERVE_MAX_REQUEST - 1) {
+    ssize_t n = read(conn->fd, conn->in + conn->in_length, SERVE_MAX_REQUEST - 1 - conn->in_length);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      } else if (errno == EINTR) {
+        continue;
+      }
+      conn_close(conn);
+      return;
+    } else if (n == 0) {
+      conn_close(conn);
+      return;
+    }
+    conn->in_length += n;
+  }
+  conn->in[conn->in_length] = '\0';
+  conn_drive(server, conn);
+}
+
+static void accept_all(server_t *server, int listen_fd) {
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) {
+        return;
+      } else if (errno == EMFILE || errno == ENFILE) {
+        printf("Dropping connection: %s\n", strerror(errno));
+        return;
+      }
+      PANIC_ERRNO("Failed to accept connection");
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    conn_t *conn = malloc_panic(sizeof(conn_t));
+    conn->fd = fd;
+    conn->in_length = 0;
+    conn->in[0] = '\0';
+    conn->out = NULL;
+    conn->out_length = conn->out_offset = conn->out_capacity = 0;
+    conn->file_fd = -1;
+    conn->close_after = false;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+    if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      PANIC_ERRNO("Failed to add connection to epoll");
+    }
+  }
+}
+
+void serve_run(build_t *build, uint16_t port) {
+  server_t server = {.build = build};
+  meta_t *meta = build->meta;
+  server.num_pages = meta->num_pages + 1 + meta->num_posts + meta->num_tags;
+  uint32_t num_listings = meta->num_pages + meta->num_tags;
+  server.later_pages = malloc_panic((num_listings + 1) * sizeof(size_t));
+  for (uint32_t l = 0; l < num_listings; ++l) {
+    uint32_t num_pages = listing_pages(meta, l);
+    server.later_pages[l] = server.num_pages;
+    server.num_pages += num_pages > 1 ? num_pages - 1 : 0;
+  }
+  server.later_pages[num_listings] = server.num_pages;
+  server.pages = calloc(server.num_pages, sizeof(page_t));
+  if (server.pages == NULL) {
+    PANIC("Failed to allocate memory");
+  }
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    PANIC_ERRNO("Failed to create socket");
+  }
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    PANIC_ERRNO("Failed to bind to port %u", port);
+  }
+  if (listen(listen_fd, SOMAXCONN) != 0) {
+    PANIC_ERRNO("Failed to listen on port %u", port);
+  }
+
+  server.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (server.epfd < 0) {
+    PANIC_ERRNO("Failed to create epoll instance");
+  }
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+  if (epoll_ctl(server.epfd, EPOLL_CTL_ADD, listen_fd, &ev) != 0) {
+    PANIC_ERRNO("Failed to add listening socket to epoll");
+  }
+
+  // no SA_RESTART, so that epoll_wait returns and the caches get flushed on the way out
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("SERVING ON http://127.0.0.1:%u (press Ctrl-C to stop)\n", port);
+  fflush(stdout);
+  struct epoll_event events[SERVE_MAX_EVENTS];
+  bool busy = true; // since the last profile flush, which happens once the requests settle
+  while (!g_stop) {
+    int timeout = g_prof_enabled && busy ? SERVE_PROF_IDLE_MS : -1;
+    int n = epoll_wait(server.epfd, events, SERVE_MAX_EVENTS, timeout);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PANIC_ERRNO("Failed to wait for events");
+    }
+    busy = n > 0;
+    if (!busy) {
+      prof_flush();
+    }
+    for (int i = 0; i < n; ++i) {
+      conn_t *conn = events[i].data.ptr;
+      if (conn == NULL) {
+        accept_all(&server, listen_fd);
+      } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        conn_close(conn);
+      } else if (events[i].events & EPOLLIN) {
+        conn_read(&server, conn);
+      } else {
+        conn_drive(&server, conn);
+      }
+    }
+  }
+  printf("STOPPING SERVER\n");
+  // open connections are dropped with the process
+  close(server.epfd);
+  close(listen_fd);
+  for (size_t i = 0; i < server.num_pages; ++i) {
+    free(server.pages[i].body);
+  }
+  free(server.pages);
+  free(server.later_pages);
+}
@@ -0,0 +1,14 @@
+#ifndef _SSG_SERVE_H_
+#define _SSG_SERVE_H_
+
+#include <stdint.h>
+
+#include "build.h"
+
+/*
+ * Development HTTP/1.1 server on localhost. Pages, posts and tags are rendered on first request
+ * and kept in memory, everything else is served from the static and wasm directories.
+ */
+extern void serve_run(build_t *build, uint16_t port);
+
+#endif
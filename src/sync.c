@@ -0,0 +1,255 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // copy_file_range
+#endif
+
+#include "sync.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "asset.h"
+#include "compress.h"
+#include "minify.h"
+#include "output.h"
+#include "prof.h"
+#include "tmpl.h"
+#include "util.h"
+
+typedef struct {
+  pool_t *pool;
+  bool fingerprint;
+  atomic_size_t copied;
+  atomic_size_t skipped;
+} sync_t;
+
+typedef struct {
+  sync_t *sync;
+  char *from;
+  char *to;
+} sync_job_t;
+
+static bool up_to_date(const struct stat *from, const char *to) {
+  struct stat statbuf;
+  return stat(to, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && statbuf.st_size == from->st_size &&
+         statbuf.st_mtim.tv_sec == from->st_mtim.tv_sec &&
+         statbuf.st_mtim.tv_nsec == from->st_mtim.tv_nsec;
+}
+
+#define MINIFIED_XATTR "user.sausage.minified"
+
+// Minified copies differ in size, so they are marked instead to tell them apart from plain ones
+static bool minified_up_to_date(const struct stat *from, const char *to) {
+  struct stat statbuf;
+  char mark;
+  return stat(to, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+         statbuf.st_mtim.tv_sec == from->st_mtim.tv_sec &&
+         statbuf.st_mtim.tv_nsec == from->st_mtim.tv_nsec &&
+         getxattr(to, MINIFIED_XATTR, &mark, sizeof(mark)) == sizeof(mark);
+}
+
+// Falls back from a reflink to an in-kernel copy to plain reads and writes
+static bool copy_contents(int from_fd, int to_fd, off_t size) {
+  if (ioctl(to_fd, FICLONE, from_fd) == 0) {
+    return true;
+  }
+  off_t copied = 0;
+  while (copied < size) {
+    ssize_t n = copy_file_range(from_fd, NULL, to_fd, NULL, size - copied, 0);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n == 0 || errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                 errno == EOPNOTSUPP) {
+        break;
+      }
+      return false;
+    }
+    copied += n;
+  }
+  // copy_file_range stops early on some special filesystems, finish the rest by hand
+  char buffer[64 * 1024];
+  for (;;) {
+    ssize_t n = read(from_fd, buffer, sizeof(buffer));
+    if (n == 0) {
+      return true;
+    } else if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (!write_all(to_fd, buffer, n)) {
+      return false;
+    }
+  }
+}
+
+static bool minify_contents(int from_fd, int to_fd, off_t size, minify_kind_e kind) {
+  char *data = malloc_panic(size);
+  for (off_t got = 0; got < size;) {
+    ssize_t n = read(from_fd, data + got, size - got);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      errno = n == 0 ? EIO : errno; // n == 0: the file shrank since it was stat'ed
+      free(data);
+      return false;
+    }
+    got += n;
+  }
+  bool written = write_all(to_fd, data, minify(kind, data, size));
+  free(data);
+  // without xattr support the file is simply minified again next time
+  fsetxattr(to_fd, MINIFIED_XATTR, "1", 1, 0);
+  return written;
+}
+
+static bool sync_file(const char *from, const char *to, minify_kind_e kind) {
+  int from_fd = open(from, O_RDONLY | O_CLOEXEC);
+  if (from_fd < 0) {
+    printf("Skipping file %s: failed to open: %s\n", from, strerror(errno));
+    return false;
+  }
+  struct stat statbuf;
+  if (fstat(from_fd, &statbuf) != 0) {
+    printf("Skipping file %s: failed to stat: %s\n", from, strerror(errno));
+    close(from_fd);
+    return false;
+  }
+  if (kind == MINIFY_NONE ? up_to_date(&statbuf, to) : minified_up_to_date(&statbuf, to)) {
+    close(from_fd);
+    return false;
+  }
+  // a fresh file, so a plain copy also drops the mark of a minified one it replaces
+  char tmp[MAX_PATH_LEN];
+  int to_fd = output_temp(to, tmp);
+  if (to_fd < 0) {
+    printf("Skipping file %s: failed to create a temporary copy: %s\n", from, strerror(errno));
+    close(from_fd);
+    return false;
+  }
+  printf("  %s => %s\n", from, to);
+  bool copied = kind == MINIFY_NONE ? copy_contents(from_fd, to_fd, statbuf.st_size)
+                                    : minify_contents(from_fd, to_fd, statbuf.st_size, kind);
+  if (!copied) {
+    output_discard(to_fd, tmp);
+    PANIC_ERRNO("Failed to copy %s to %s", from, to);
+  }
+  // the copy takes the source's mtime, which is what the next build compares against
+  struct timespec times[2] = {statbuf.st_atim, statbuf.st_mtim};
+  if (futimens(to_fd, times) != 0) {
+    output_discard(to_fd, tmp);
+    PANIC_ERRNO("Failed to set modification time of %s", to);
+  }
+  close(from_fd);
+  if (!output_replace(to_fd, tmp, to)) {
+    PANIC_ERRNO("Failed to replace %s", to);
+  }
+  return true;
+}
+
+bool copy_file(const char *from, const char *to) {
+  return sync_file(from, to, minify_enabled() ? minify_kind(from) : MINIFY_NONE);
+}
+
+bool fingerprint_file(const char *path) {
+  char fingerprinted[MAX_PATH_LEN];
+  bool changed = asset_fingerprint(path, fingerprinted);
+  sync_file(path, fingerprinted, MINIFY_NONE);
+  if (compress_enabled() && compress_wanted(fingerprinted)) {
+    compress_file(fingerprinted);
+  }
+  output_record_asset(fingerprinted);
+  return changed;
+}
+
+static void copy_job(void *arg, uint32_t worker) {
+  (void)worker;
+  sync_job_t *job = arg;
+  uint64_t start = prof_begin();
+  if (copy_file(job->from, job->to)) {
+    atomic_fetch_add(&job->sync->copied, 1);
+  } else {
+    atomic_fetch_add(&job->sync->skipped, 1);
+  }
+  // also when the copy was up to date, the siblings may be missing or stale
+  if (compress_enabled() && compress_wanted(job->to)) {
+    compress_file(job->to);
+  }
+  if (job->sync->fingerprint && assets_enabled() && asset_wanted(job->to)) {
+    fingerprint_file(job->to);
+  }
+  prof_end("static", "file", start);
+  free(job->from);
+  free(job->to);
+  free(job);
+}
+
+static char *join_path(const char *dir, const char *name) {
+  char path[MAX_PATH_LEN];
+  int s = snprintf(path, MAX_PATH_LEN, "%s/%s", dir, name);
+  if (s < 0) {
+    PANIC_ERRNO("Failed to construct path");
+  } else if (s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct path: length exceeded (%d >= %d)", s, MAX_PATH_LEN);
+  }
+  char *copy = malloc_panic(s + 1);
+  memcpy(copy, path, s + 1);
+  return copy;
+}
+
+// Walks the tree on the calling thread and hands each file to the pool
+static void sync_dir(sync_t *sync, const char *fromdir, const char *todir) {
+  DIR *dirp = opendir(fromdir);
+  if (dirp == NULL) {
+    PANIC_ERRNO("Failed to open directory: %s", fromdir);
+  }
+  make_output_dir((char *)todir);
+  struct dirent *ep;
+  while ((ep = readdir(dirp)) != NULL) {
+    if (strcmp(".", ep->d_name) == 0 || strcmp("..", ep->d_name) == 0) {
+      continue;
+    }
+    char *from = join_path(fromdir, ep->d_name);
+    unsigned char type = ep->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat statbuf;
+      if (lstat(from, &statbuf) == 0) {
+        type = S_ISREG(statbuf.st_mode) ? DT_REG : S_ISDIR(statbuf.st_mode) ? DT_DIR : DT_UNKNOWN;
+      }
+    }
+    if (type == DT_DIR) {
+      char *to = join_path(todir, ep->d_name);
+      sync_dir(sync, from, to);
+      free(from);
+      free(to);
+    } else if (type == DT_REG) {
+      sync_job_t *job = malloc_panic(sizeof(sync_job_t));
+      *job = (sync_job_t){.sync = sync, .from = from, .to = join_path(todir, ep->d_name)};
+      pool_submit(sync->pool, copy_job, job);
+    } else {
+      // skip file if not regular
+      free(from);
+    }
+  }
+  closedir(dirp);
+}
+
+void copy_files(pool_t *pool, const char *fromdir, const char *todir, bool fingerprint) {
+  uint64_t start = prof_begin();
+  sync_t sync = {.pool = pool, .fingerprint = fingerprint};
+  atomic_init(&sync.copied, 0);
+  atomic_init(&sync.skipped, 0);
+  sync_dir(&sync, fromdir, todir);
+  pool_wait(pool);
+  printf("  %s: %zu copied, %zu up to date\n", fromdir, atomic_load(&sync.copied),
+         atomic_load(&sync.skipped));
+  prof_end("static", fromdir, start);
+}
@@ -0,0 +1,22 @@
+#ifndef _SSG_SYNC_H_
+#define _SSG_SYNC_H_
+
+#include <stdbool.h>
+
+#include "pool.h"
+
+/*
+ * Copies static files into the output directory. Files whose size and modification time match
+ * the copy already there are skipped, copies get the source's modification time. With --minify,
+ * CSS and JS are minified on the way.
+ */
+
+// Returns whether the file was copied, false if it was up to date or could not be copied
+extern bool copy_file(const char *from, const char *to);
+// Copies path, an output, to its fingerprinted name. Returns whether its URL changed.
+extern bool fingerprint_file(const char *path);
+// Mirrors fromdir into todir recursively, copying files on the pool. With fingerprint, assets
+// are also fingerprinted when fingerprinting is enabled.
+extern void copy_files(pool_t *pool, const char *fromdir, const char *todir, bool fingerprint);
+
+#endif
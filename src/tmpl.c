@@ -3,14 +3,22 @@
 #include <assert.h>
 #include <cmark.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <tree_sitter/api.h>
 #include <unistd.h>
 
+#include "asset.h"
+#include "cache.h"
+#include "compress.h"
 #include "hescape/hescape.h"
+#include "minify.h"
 #include "mustach/mustach.h"
+#include "output.h"
+#include "prof.h"
 #include "util.h"
 
 #define TS_GRAMMARS                                                                                \
@@ -32,18 +40,10 @@ Language g_languages[] = {
 #undef X
 };
 
-FILE *open_post_md(const char *slug) {
-  char path[MAX_PATH_LEN];
-  snprintf(path, sizeof(path), "posts/%s.md", slug);
-  FILE *fp = fopen(path, "r");
-  if (fp == NULL) {
-    PANIC_ERRNO("Failed to open post %s", path);
-  }
-  return fp;
-}
+// Bump when the highlighter output changes, so cached content is rendered again
+#define HIGHLIGHT_VERSION 2
 
-static bool is_interesting_node(TSNode node) {
-  char *interesting_node_types[] = {
+static const char *g_interesting_node_types[] = {
       // commment
       "line_comment",
       "comment",
@@ -58,63 +58,262 @@ static bool is_interesting_node(TSNode node) {
       "type_identifier",
       // preproc
       "preproc_include",
-  };
-  for (size_t i = 0; i < arrlen(interesting_node_types); ++i) {
-    if (strcmp(ts_node_type(node), interesting_node_types[i]) == 0) {
-      return true;
+};
+
+// Per-language lookup of interesting node types, indexed by symbol
+static struct {
+  bool *interesting;
+  uint32_t num_symbols;
+} g_highlight_tables[arrlen(g_languages)];
+static pthread_once_t g_highlight_tables_once = PTHREAD_ONCE_INIT;
+
+static void init_highlight_tables(void) {
+  for (size_t i = 0; i < arrlen(g_languages); ++i) {
+    const TSLanguage *language = g_languages[i].tsl();
+    uint32_t num_symbols = ts_language_symbol_count(language);
+    bool *interesting = malloc_panic(num_symbols * sizeof(bool));
+    for (TSSymbol symbol = 0; symbol < num_symbols; ++symbol) {
+      const char *name = ts_language_symbol_name(language, symbol);
+      interesting[symbol] = false;
+      for (size_t j = 0; name != NULL && j < arrlen(g_interesting_node_types); ++j) {
+        if (strcmp(name, g_interesting_node_types[j]) == 0) {
+          interesting[symbol] = true;
+          break;
+        }
+      }
+    }
+    g_highlight_tables[i].interesting = interesting;
+    g_highlight_tables[i].num_symbols = num_symbols;
+  }
+}
+
+// Parsers and the output buffer are reused across code blocks, one set per thread
+typedef struct {
+  TSParser *parsers[arrlen(g_languages)];
+  strbuf_t out;
+} highlighter_t;
+
+static pthread_key_t g_highlighter_key;
+static pthread_once_t g_highlighter_once = PTHREAD_ONCE_INIT;
+
+static void free_highlighter(void *arg) {
+  highlighter_t *hl = arg;
+  for (size_t i = 0; i < arrlen(g_languages); ++i) {
+    if (hl->parsers[i] != NULL) {
+      ts_parser_delete(hl->parsers[i]);
     }
   }
-  return false;
+  strbuf_free(&hl->out);
+  free(hl);
 }
 
-static char *highlight_code_node(char *dest, const char *src, uint32_t *cursor, TSNode node) {
-  printf("%s\n", ts_node_type(node));
-  uint32_t child_count = ts_node_child_count(node);
-  if (child_count == 0) {
-    uint32_t start = ts_node_start_byte(node);
-    uint32_t end = ts_node_end_byte(node);
-    if (*cursor < start) {
-      char *esc_code = NULL;
-      int len = hesc_escape_html((uint8_t **)&esc_code, (uint8_t *)src + *cursor, start - *cursor);
-      dest += sprintf(dest, "%.*s", len, esc_code);
+static void init_highlighter_key(void) {
+  if (pthread_key_create(&g_highlighter_key, free_highlighter)) {
+    PANIC("Failed to create highlighter key");
+  }
+}
+
+static highlighter_t *get_highlighter(void) {
+  pthread_once(&g_highlighter_once, init_highlighter_key);
+  highlighter_t *hl = pthread_getspecific(g_highlighter_key);
+  if (hl == NULL) {
+    hl = calloc(1, sizeof(highlighter_t));
+    if (hl == NULL) {
+      PANIC("Failed to allocate memory");
     }
-    if (is_interesting_node(node)) {
-      dest += sprintf(dest, "<span class=\"%s\">%.*s</span>", ts_node_type(node), end - start,
-                      src + start);
-    } else {
-      char *esc_code = NULL;
-      int len = hesc_escape_html((uint8_t **)&esc_code, (uint8_t *)src + start, end - start);
-      dest += sprintf(dest, "%.*s", len, esc_code);
+    pthread_setspecific(g_highlighter_key, hl);
+  }
+  return hl;
+}
+
+static TSParser *get_parser(highlighter_t *hl, size_t language) {
+  if (hl->parsers[language] == NULL) {
+    hl->parsers[language] = ts_parser_new();
+    if (!ts_parser_set_language(hl->parsers[language], g_languages[language].tsl())) {
+      PANIC("Incompatible tree-sitter grammar: %s", g_languages[language].name);
     }
-    *cursor = end;
+  }
+  return hl->parsers[language];
+}
+
+// Escapes in bounded chunks so the buffer never has to hold the worst case for a whole block
+static void append_escaped(strbuf_t *out, const char *src, size_t length, int flags) {
+  while (length > 0) {
+    size_t chunk = length < 4096 ? length : 4096;
+    char *dest = strbuf_reserve(out, HESC_MAX_ESCAPED(chunk));
+    out->length += hesc_escape_html_into((uint8_t *)dest, (const uint8_t *)src, chunk, flags);
+    src += chunk;
+    length -= chunk;
+  }
+  out->data[out->length] = '\0';
+}
+
+static void highlight_leaf(strbuf_t *out, const char *src, uint32_t *cursor, TSNode node,
+                           bool interesting) {
+  uint32_t start = ts_node_start_byte(node);
+  uint32_t end = ts_node_end_byte(node);
+  if (*cursor < start) {
+    append_escaped(out, src + *cursor, start - *cursor, HESC_APOS);
+  }
+  if (interesting) {
+    strbuf_append_str(out, "<span class=\"");
+    strbuf_append_str(out, ts_node_type(node));
+    strbuf_append_str(out, "\">");
+    append_escaped(out, src + start, end - start, HESC_APOS);
+    strbuf_append_str(out, "</span>");
   } else {
-    bool interesting = is_interesting_node(node);
-    if (interesting) {
-      dest += sprintf(dest, "<span class=\"%s\">", ts_node_type(node));
+    append_escaped(out, src + start, end - start, HESC_APOS);
+  }
+  *cursor = end;
+}
+
+// Walks the tree depth first with a cursor, so deep trees don't grow the stack
+static void highlight_code(strbuf_t *out, const char *src, uint32_t srclen, TSTree *tree,
+                           size_t language) {
+  const bool *interesting = g_highlight_tables[language].interesting;
+  uint32_t num_symbols = g_highlight_tables[language].num_symbols;
+  TSTreeCursor walk = ts_tree_cursor_new(ts_tree_root_node(tree));
+  uint32_t cursor = 0;
+  for (;;) {
+    TSNode node = ts_tree_cursor_current_node(&walk);
+    TSSymbol symbol = ts_node_symbol(node);
+    bool is_interesting = symbol < num_symbols && interesting[symbol];
+    if (ts_tree_cursor_goto_first_child(&walk)) {
+      if (is_interesting) {
+        strbuf_append_str(out, "<span class=\"");
+        strbuf_append_str(out, ts_node_type(node));
+        strbuf_append_str(out, "\">");
+      }
+      continue;
     }
-    for (uint32_t i = 0; i < child_count; ++i) {
-      dest = highlight_code_node(dest, src, cursor, ts_node_child(node, i));
+    highlight_leaf(out, src, &cursor, node, is_interesting);
+    while (!ts_tree_cursor_goto_next_sibling(&walk)) {
+      if (!ts_tree_cursor_goto_parent(&walk)) {
+        goto done;
+      }
+      symbol = ts_node_symbol(ts_tree_cursor_current_node(&walk));
+      if (symbol < num_symbols && interesting[symbol]) {
+        strbuf_append_str(out, "</span>");
+      }
     }
-    if (interesting) {
-      dest += sprintf(dest, "</span>");
+  }
+done:
+  ts_tree_cursor_delete(&walk);
+  if (cursor < srclen) {
+    append_escaped(out, src + cursor, srclen - cursor, HESC_APOS);
+  }
+}
+
+static size_t language_of(const char *name) {
+  for (size_t i = 0; i < arrlen(g_languages); ++i) {
+    if (strcmp(name, g_languages[i].name) == 0) {
+      return i;
     }
   }
-  return dest;
+  return arrlen(g_languages);
 }
 
-static char *highlight_code(char *dest, const char *src, uint32_t srclen, TSTree *tree) {
-  TSNode root_node = ts_tree_root_node(tree);
-  uint32_t cursor = 0;
-  dest = highlight_code_node(dest, src, &cursor, root_node);
-  if (cursor < srclen) {
-    dest += sprintf(dest, "%.*s", srclen - cursor, src + cursor);
+bool highlight_block(strbuf_t *out, const char *language_name, const char *code, size_t length) {
+  size_t language = language_of(language_name);
+  if (language == arrlen(g_languages)) {
+    return false;
+  }
+  pthread_once(&g_highlight_tables_once, init_highlight_tables);
+  TSTree *tree =
+      ts_parser_parse_string(get_parser(get_highlighter(), language), NULL, code, length);
+  strbuf_append_str(out, "<pre><code class=\"language-");
+  strbuf_append_str(out, language_name);
+  strbuf_append_str(out, "\">");
+  highlight_code(out, code, length, tree, language);
+  strbuf_append_str(out, "</code></pre>");
+  ts_tree_delete(tree);
+  return true;
+}
+
+static uint64_t g_content_salt;
+static pthread_once_t g_content_salt_once = PTHREAD_ONCE_INIT;
+static bool g_low_memory = false;
+
+void low_memory_init(bool enabled) { g_low_memory = enabled; }
+
+bool low_memory_enabled(void) { return g_low_memory; }
+
+// Hash of everything besides the markdown that affects rendered content
+static void init_content_salt(void) {
+  char buf[4096];
+  int len = snprintf(buf, sizeof(buf), "sausage %d highlight %d cmark %s", SSG_VERSION,
+                     HIGHLIGHT_VERSION, cmark_version_string());
+  for (size_t i = 0; i < arrlen(g_languages) && len < sizeof(buf); ++i) {
+    const TSLanguage *language = g_languages[i].tsl();
+    len += snprintf(buf + len, sizeof(buf) - len, " %s:%u:%u", g_languages[i].name,
+                    ts_language_version(language), ts_language_symbol_count(language));
+  }
+  for (size_t i = 0; i < arrlen(g_interesting_node_types) && len < sizeof(buf); ++i) {
+    len += snprintf(buf + len, sizeof(buf) - len, " %s", g_interesting_node_types[i]);
   }
-  return dest;
+  g_content_salt = hash_bytes(buf, len < sizeof(buf) ? len : sizeof(buf));
+}
+
+#define MARKDOWN_CHUNK (16 * 1024)
+
+// Reads the Markdown in fixed chunks, feeding them to parser if there is one, and returns its hash
+static uint64_t stream_markdown(const char *path, cmark_parser *parser) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  char chunk[MARKDOWN_CHUNK];
+  uint64_t hash = hash_bytes(NULL, 0);
+  for (;;) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n == 0) {
+      break;
+    } else if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PANIC_ERRNO("Failed to read %s", path);
+    }
+    hash = hash_update(hash, chunk, n);
+    if (parser != NULL) {
+      cmark_parser_feed(parser, chunk, n);
+    }
+  }
+  close(fd);
+  return hash;
 }
 
 char *render_post_content(const char *slug) {
-  FILE *post_md = open_post_md(slug);
-  cmark_node *node = cmark_parse_file(post_md, CMARK_OPT_DEFAULT);
+  char path[MAX_PATH_LEN];
+  snprintf(path, sizeof(path), POSTS_DIR "/%s.md", slug);
+  // in low-memory mode the source is read twice in chunks, once for the key and once to parse
+  file_view_t md = {.data = empty_string()};
+  if (!g_low_memory) {
+    md = map_file(path);
+  }
+
+  pthread_once(&g_content_salt_once, init_content_salt);
+  uint64_t key[2] = {g_low_memory ? stream_markdown(path, NULL) : hash_bytes(md.data, md.length),
+                     g_content_salt};
+  uint64_t cache_key = hash_bytes(key, sizeof(key));
+  string_t cached;
+  uint64_t start = prof_begin();
+  if (cache_get("content", cache_key, &cached)) {
+    unmap_file(&md);
+    prof_end("markdown", "cached", start);
+    return cached.data;
+  }
+
+  cmark_node *node;
+  if (g_low_memory) {
+    cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+    stream_markdown(path, parser);
+    node = cmark_parser_finish(parser);
+    cmark_parser_free(parser);
+  } else {
+    node = cmark_parse_document(md.data, md.length, CMARK_OPT_DEFAULT);
+  }
+  prof_end("markdown", "parse", start);
 
   // DEBUG
   {
@@ -132,33 +331,33 @@ char *render_post_content(const char *slug) {
           cmark_node *code_block_node = cmark_iter_get_node(iter);
           const char *code = cmark_node_get_literal(code_block_node);
 
-          TSLanguage *language = NULL;
           const char *fence_info = cmark_node_get_fence_info(code_block_node);
-          for (int i = 0; i < sizeof(g_languages) / sizeof(*g_languages); ++i) {
-            if (!strcmp(fence_info, g_languages[i].name)) {
-              language = g_languages[i].tsl();
-              break;
-            }
-          }
-          if (language == NULL) {
+          if (language_of(fence_info) == arrlen(g_languages)) {
             break;
           }
-          TSParser *parser = ts_parser_new();
-          ts_parser_set_language(parser, language);
-          assert(ts_parser_language(parser) != NULL);
-          TSTree *tree = ts_parser_parse_string(parser, NULL, code, strlen(code));
-          ts_parser_delete(parser);
-
-          char code_buf[4096]; // TODO: dynamic buffer
-          char *code_start =
-              code_buf + sprintf(code_buf, "<pre><code class=\"language-%s\">", fence_info);
+
+          // the content salt covers the grammars and the highlighter itself
+          uint64_t code_key[3] = {hash_bytes(fence_info, strlen(fence_info)),
+                                  hash_bytes(code, strlen(code)), g_content_salt};
+          uint64_t code_cache_key = hash_bytes(code_key, sizeof(code_key));
+          const char *html;
+          if (!code_cache_get(code_cache_key, &html)) {
+            uint64_t highlight_start = prof_begin();
+            highlighter_t *hl = get_highlighter();
+            strbuf_reset(&hl->out);
+            highlight_block(&hl->out, fence_info, code, strlen(code));
+            // new entries stay in memory until the end of the build, and the content cache
+            // already has the whole post
+            if (!g_low_memory) {
+              code_cache_put(code_cache_key, hl->out.data, hl->out.length);
+            }
+            html = hl->out.data;
+            prof_end("highlight", fence_info, highlight_start);
+          }
           cmark_node *new_code_node = cmark_node_new(CMARK_NODE_HTML_BLOCK);
-          char *code_end = highlight_code(code_start, code, strlen(code), tree);
-          sprintf(code_end, "</code></pre>");
-          cmark_node_set_literal(new_code_node, code_buf);
+          cmark_node_set_literal(new_code_node, html);
           assert(cmark_node_insert_after(code_block_node, new_code_node));
           cmark_node_free(code_block_node); // automatically unlinks
-          ts_tree_delete(tree);
         }
         break;
       case CMARK_EVENT_EXIT:
@@ -168,37 +367,161 @@ char *render_post_content(const char *slug) {
     cmark_iter_free(iter);
   }
 
-  fclose(post_md);
+  unmap_file(&md);
+  start = prof_begin();
   char *html = cmark_render_html(node, CMARK_OPT_UNSAFE);
   cmark_node_free(node);
+  prof_end("markdown", "html", start);
+  cache_put("content", cache_key, html, strlen(html));
   return html;
 }
 
-string_t read_template(const char *slug) {
-  char path[MAX_PATH_LEN];
-  snprintf(path, sizeof(path), "templates/%s.mustache", slug);
-  return read_file(path);
+// Every name templates can use. Lookups resolve a name to its symbol once, then switch on it.
+#define ASSET_PREFIX "asset:"
+
+#define TMPL_SYMBOLS                                                                               \
+  X(posts)                                                                                         \
+  X(tags)                                                                                          \
+  X(js)                                                                                            \
+  X(slug)                                                                                          \
+  X(title)                                                                                         \
+  X(desc)                                                                                          \
+  X(content)                                                                                       \
+  X(date)                                                                                          \
+  X(id)                                                                                            \
+  X(path)                                                                                          \
+  X(site_name)                                                                                     \
+  X(site_url)                                                                                      \
+  X(site_desc)                                                                                     \
+  X(version)                                                                                       \
+  X(page)                                                                                          \
+  X(num_pages)                                                                                     \
+  X(prev)                                                                                          \
+  X(next)
+
+typedef enum {
+  SYM_UNKNOWN,
+#define X(name) SYM_##name,
+  TMPL_SYMBOLS
+#undef X
+} symbol_e;
+
+static const char *g_symbol_names[] = {
+    "",
+#define X(name) #name,
+    TMPL_SYMBOLS
+#undef X
+};
+
+/*
+ * Perfect hash on the length and one distinguishing character, checked with a single compare.
+ * Adding a name to TMPL_SYMBOLS needs a case here too, which check_symbols() enforces.
+ */
+static symbol_e symbol_of(const char *name) {
+  size_t length = strlen(name);
+  symbol_e sym = SYM_UNKNOWN;
+  switch (length) {
+  case 2:
+    sym = name[0] == 'j' ? SYM_js : SYM_id;
+    break;
+  case 4:
+    switch (name[0]) {
+    case 't':
+      sym = SYM_tags;
+      break;
+    case 's':
+      sym = SYM_slug;
+      break;
+    case 'p':
+      sym = name[2] == 't' ? SYM_path : name[2] == 'g' ? SYM_page : SYM_prev;
+      break;
+    case 'n':
+      sym = SYM_next;
+      break;
+    case 'd':
+      sym = name[1] == 'e' ? SYM_desc : SYM_date;
+      break;
+    }
+    break;
+  case 5:
+    sym = name[0] == 'p' ? SYM_posts : SYM_title;
+    break;
+  case 7:
+    sym = name[0] == 'c' ? SYM_content : SYM_version;
+    break;
+  case 8:
+    sym = SYM_site_url;
+    break;
+  case 9:
+    sym = name[0] == 'n' ? SYM_num_pages : name[5] == 'n' ? SYM_site_name : SYM_site_desc;
+    break;
+  }
+  if (sym == SYM_UNKNOWN || memcmp(name, g_symbol_names[sym], length + 1) != 0) {
+    return SYM_UNKNOWN;
+  }
+  return sym;
+}
+
+// Every name of TMPL_SYMBOLS has to hash to itself, or templates would silently miss it
+static void check_symbols(void) {
+  for (symbol_e sym = SYM_UNKNOWN + 1; sym < arrlen(g_symbol_names); ++sym) {
+    if (symbol_of(g_symbol_names[sym]) != sym) {
+      PANIC("symbol_of() has no case for template name %s", g_symbol_names[sym]);
+    }
+  }
+}
+
+// Whether the posts iterated in the current state are a page's slice of the listing
+static bool paginated(const closure_t *c) {
+  switch (c->state) {
+  case ROOT:
+  case POST:
+    return c->page > 0 && c->listing == ROOT;
+  case TAG:
+  case TAG_POST:
+    return c->page > 0 && c->listing == TAG;
+  default:
+    return false;
+  }
+}
+
+static uint32_t slice_start(const closure_t *c) { return (c->page - 1) * c->meta->per_page; }
+
+static uint32_t slice_end(const closure_t *c, uint32_t num_posts) {
+  uint64_t end = (uint64_t)c->page * c->meta->per_page;
+  return end < num_posts ? end : num_posts;
 }
 
 int enter(void *closure, const char *name) {
   closure_t *c = (closure_t *)closure;
+  symbol_e sym = symbol_of(name);
+  if (c->probe && sym == SYM_posts && c->state == c->listing) {
+    c->listed = true;
+    return 0;
+  }
+  if (c->page > 0 && c->state == c->listing &&
+      ((sym == SYM_prev && c->page > 1) || (sym == SYM_next && c->page < c->num_pages))) {
+    c->state = PAGER;
+    return 1;
+  }
   switch (c->state) {
   case ROOT:
-    if (strcmp("posts", name) == 0 && c->meta->num_posts > 0) {
+    if (sym == SYM_posts && c->meta->num_posts > 0) {
+      c->index = paginated(c) ? slice_start(c) : 0;
       c->state = POST;
       return 1;
-    } else if (strcmp("tags", name) == 0 && c->meta->num_tags > 0) {
+    } else if (sym == SYM_tags && c->meta->num_tags > 0) {
       c->state = TAG;
       return 1;
     }
     break;
   case POST:
-    if (strcmp("tags", name) == 0 && c->meta->posts[c->index].num_tags > 0) {
+    if (sym == SYM_tags && c->meta->posts[c->index].num_tags > 0) {
       c->state = POST_TAG;
       return 1;
-    } else if (strcmp("js", name) == 0) {
+    } else if (sym == SYM_js) {
       char path[MAX_PATH_LEN];
-      int bytes = snprintf(path, MAX_PATH_LEN, OUTPUT_DIR "/scripts/post/%s.js",
+      int bytes = snprintf(path, MAX_PATH_LEN, STATIC_DIR "/scripts/post/%s.js",
                            c->meta->posts[c->index].slug);
       assert(bytes >= 0 && bytes < MAX_PATH_LEN);
       if (access(path, R_OK) == 0) {
@@ -208,7 +531,8 @@ int enter(void *closure, const char *name) {
     }
     break;
   case TAG:
-    if (strcmp("posts", name) == 0 && c->meta->tags[c->index].num_posts > 0) {
+    if (sym == SYM_posts && c->meta->tags[c->index].num_posts > 0) {
+      c->index_inner = paginated(c) ? slice_start(c) : 0;
       c->state = TAG_POST;
       return 1;
     }
@@ -216,6 +540,7 @@ int enter(void *closure, const char *name) {
   case POST_TAG:
   case POST_JS:
   case TAG_POST:
+  case PAGER:
     break;
   }
   return 0;
@@ -223,7 +548,8 @@ int enter(void *closure, const char *name) {
 
 int next(void *closure) {
   closure_t *c = (closure_t *)closure;
-  if (c->state == POST && c->index + 1 < c->meta->num_posts) {
+  if (c->state == POST &&
+      c->index + 1 < (paginated(c) ? slice_end(c, c->meta->num_posts) : c->meta->num_posts)) {
     ++c->index;
     return 1;
   }
@@ -235,7 +561,9 @@ int next(void *closure) {
     ++c->index_inner;
     return 1;
   }
-  if (c->state == TAG_POST && c->index_inner + 1 < c->meta->tags[c->index].num_posts) {
+  uint32_t num_tag_posts = c->state == TAG_POST ? c->meta->tags[c->index].num_posts : 0;
+  if (c->state == TAG_POST &&
+      c->index_inner + 1 < (paginated(c) ? slice_end(c, num_tag_posts) : num_tag_posts)) {
     ++c->index_inner;
     return 1;
   }
@@ -263,58 +591,90 @@ int leave(void *closure) {
     c->state = TAG;
     c->index_inner = 0;
     break;
+  case PAGER:
+    c->state = c->listing;
+    break;
   }
   return 0;
 }
 
-char *get_post(meta_post_t *post, const char *name) {
-  if (strcmp(name, "slug") == 0) {
+char *get_post(meta_post_t *post, symbol_e sym) {
+  switch (sym) {
+  case SYM_slug:
     return post->slug;
-  } else if (strcmp(name, "title") == 0) {
+  case SYM_title:
     return post->title;
-  } else if (strcmp(name, "desc") == 0) {
+  case SYM_desc:
     return (post->desc != NULL) ? post->desc : "";
-  } else if (strcmp(name, "content") == 0) {
-    post->content = render_post_content(post->slug);
+  case SYM_content:
+    if (g_low_memory) {
+      return render_post_content(post->slug); // get() has mustach free it once written
+    }
+    pthread_mutex_lock(&post->lock);
+    if (post->content == NULL) {
+      post->content = render_post_content(post->slug);
+    }
+    pthread_mutex_unlock(&post->lock);
     return post->content;
-  } else if (strcmp(name, "date") == 0) {
+  case SYM_date:
     return post->date;
+  default:
+    return NULL;
   }
-  return NULL;
 }
 
-char *get_tag(meta_tag_t *tag, const char *name) {
-  printf("tag.'%s'\n", name);
-  if (strcmp(name, "id") == 0) {
-    printf("tag id = %s\n", tag->id);
-    return tag->id;
-  }
-  return NULL;
-}
+char *get_tag(meta_tag_t *tag, symbol_e sym) { return sym == SYM_id ? tag->id : NULL; }
 
-char *get_js(meta_post_t *post, const char *name) {
-  if (strcmp(name, "path") == 0) {
-    char path[MAX_PATH_LEN];
-    int bytes = snprintf(path, sizeof(path), "/scripts/post/%s.js", post->slug);
-    assert(bytes >= 0 && bytes < MAX_PATH_LEN);
-    post->js = malloc_panic(bytes + 1);
-    memcpy(post->js, path, bytes + 1);
-    return post->js;
-  }
-  return NULL;
+char *get_js(meta_post_t *post, symbol_e sym) {
+  return sym == SYM_path ? (char *)asset_url(post->js) : NULL;
 }
 
-char *get_root(meta_t *meta, const char *name) {
-  if (strcmp(name, "site_name") == 0) {
+char *get_root(meta_t *meta, symbol_e sym) {
+  switch (sym) {
+  case SYM_site_name:
     return meta->site_name;
-  } else if (strcmp(name, "site_url") == 0) {
+  case SYM_site_url:
     return meta->site_url;
-  } else if (strcmp(name, "site_desc") == 0) {
+  case SYM_site_desc:
     return meta->site_desc;
-  } else if (strcmp(name, "version") == 0) {
+  case SYM_version:
     return meta->version;
+  default:
+    return NULL;
+  }
+}
+
+// The position of a listing page and the URLs of its neighbours, malloc'd
+char *get_pager(const closure_t *c, symbol_e sym) {
+  char value[MAX_PATH_LEN];
+  int s;
+  uint32_t page = sym == SYM_prev ? c->page - 1 : c->page + 1;
+  switch (sym) {
+  case SYM_page:
+    s = snprintf(value, sizeof(value), "%u", c->page);
+    break;
+  case SYM_num_pages:
+    s = snprintf(value, sizeof(value), "%u", c->num_pages);
+    break;
+  case SYM_prev:
+  case SYM_next:
+    if (page < 1 || page > c->num_pages) {
+      return NULL;
+    }
+    // the first page keeps the listing's own URL
+    s = page == 1 ? snprintf(value, sizeof(value), "/%s.html", c->listing_slug)
+                  : snprintf(value, sizeof(value), "/%s/%u.html", c->listing_slug, page);
+    break;
+  default:
+    return NULL;
+  }
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    PANIC("Failed to construct %s of page %u of %s", g_symbol_names[sym], c->page,
+          c->listing_slug);
   }
-  return NULL;
+  char *copy = malloc_panic(s + 1);
+  memcpy(copy, value, s + 1);
+  return copy;
 }
 
 int get(void *closure, const char *name, struct mustach_sbuf *sbuf) {
@@ -325,31 +685,54 @@ int get(void *closure, const char *name, struct mustach_sbuf *sbuf) {
       .freecb = NULL,
       .length = 0,
   };
+  // {{asset:/style.css}} links a static file, by its fingerprinted name if it has one
+  if (strncmp(name, ASSET_PREFIX, strlen(ASSET_PREFIX)) == 0) {
+    sbuf->value = asset_url(name + strlen(ASSET_PREFIX));
+    return MUSTACH_OK;
+  }
+  // the probe only follows sections, any value will do
+  if (c->probe) {
+    sbuf->value = "";
+    return MUSTACH_OK;
+  }
+  symbol_e sym = symbol_of(name);
   switch (c->state) {
   case ROOT:
     break;
+  case PAGER:
+    if (c->listing == TAG) {
+      sbuf->value = get_tag(&c->meta->tags[c->index], sym);
+    }
+    break;
   case POST:
-    sbuf->value = get_post(&c->meta->posts[c->index], name);
+    sbuf->value = get_post(&c->meta->posts[c->index], sym);
     break;
   case TAG:
-    sbuf->value = get_tag(&c->meta->tags[c->index], name);
+    sbuf->value = get_tag(&c->meta->tags[c->index], sym);
     break;
   case POST_TAG: {
     meta_post_t *post = &c->meta->posts[c->index];
     uint32_t tag_handle = post->tag_handles[c->index_inner];
-    sbuf->value = get_tag(&c->meta->tags[tag_handle], name);
+    sbuf->value = get_tag(&c->meta->tags[tag_handle], sym);
   } break;
   case POST_JS:
-    sbuf->value = get_js(&c->meta->posts[c->index], name);
+    sbuf->value = get_js(&c->meta->posts[c->index], sym);
     break;
   case TAG_POST: {
     meta_tag_t *tag = &c->meta->tags[c->index];
     uint32_t post_handle = tag->post_handles[c->index_inner];
-    sbuf->value = get_post(&c->meta->posts[post_handle], name);
+    sbuf->value = get_post(&c->meta->posts[post_handle], sym);
   } break;
   }
+  if (g_low_memory && sym == SYM_content && sbuf->value != NULL) {
+    sbuf->freecb = free;
+  }
+  if (sbuf->value == NULL && c->page > 0) {
+    sbuf->value = get_pager(c, sym);
+    sbuf->freecb = sbuf->value != NULL ? free : NULL;
+  }
   if (sbuf->value == NULL) {
-    sbuf->value = get_root(c->meta, name);
+    sbuf->value = get_root(c->meta, sym);
   }
   if (sbuf->value == NULL) {
     fprintf(stderr, "Failed to get value %s in state %d\n", name, c->state);
@@ -359,128 +742,270 @@ int get(void *closure, const char *name, struct mustach_sbuf *sbuf) {
 }
 
 int partial(void *closure, const char *name, struct mustach_sbuf *sbuf) {
-  string_t tmpl = read_template(name);
+  const template_t *tmpl = template_get(name);
+  if (tmpl == NULL) {
+    fprintf(stderr, "Missing partial %s\n", name);
+    return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+  }
+  // borrowed from the store, which outlives every render
   *sbuf = (struct mustach_sbuf){
-      .value = tmpl.data,
+      .value = tmpl->source.data,
       .closure = closure,
-      .freecb = free,
-      .length = tmpl.length,
+      .freecb = NULL,
+      .length = tmpl->source.length,
   };
   return MUSTACH_OK;
 }
 
-FILE *open_output_file(char *slug, char *fext) {
-  char path[MAX_PATH_LEN];
-  snprintf(path, sizeof(path), OUTPUT_DIR "/%s.%s", slug, fext);
-  FILE *fp = fopen(path, "w");
-  if (fp == NULL) {
-    PANIC_ERRNO("Failed to open file %s", path);
-  }
-  return fp;
-}
-
-void render_file(closure_t *closure, string_t tmpl, char *slug_out, char *ext) {
-  FILE *fp_out = open_output_file(slug_out, ext);
-
-  struct mustach_itf itf = {
-      .start = NULL,
-      .put = NULL,
-      .enter = enter,
-      .next = next,
-      .leave = leave,
-      .partial = partial,
-      .emit = NULL,
-      .get = get,
-      .stop = NULL,
-  };
-  int status =
-      mustach_file(tmpl.data, tmpl.length, &itf, closure, Mustach_With_NoExtensions, fp_out);
-  if (status == -1) {
-    PANIC_ERRNO("Failed to render template %*s to page %s", (int)tmpl.length, tmpl.data, slug_out);
-  } else if (status < -1) {
-    PANIC("Failed to render template: %d", status);
+// Collects the page in the closure's buffer instead of writing to the FILE mustach passes in
+static int emit(void *closure, const char *buffer, size_t size, int escape, FILE *file) {
+  (void)file;
+  closure_t *c = (closure_t *)closure;
+  if (escape) {
+    append_escaped(&c->out, buffer, size, 0);
+  } else {
+    strbuf_append(&c->out, buffer, size);
   }
-  fclose(fp_out);
+  return MUSTACH_OK;
 }
 
-void make_output_dir(char *path) {
-  if (mkdir(path, 0777)) {
-    if (errno == EEXIST) {
-      struct stat statbuf;
-      lstat(path, &statbuf);
-      if (!S_ISDIR(statbuf.st_mode)) {
-        PANIC("Non-directory already exists: %s (0%06o)", path, statbuf.st_mode);
-      }
-      return;
+static const struct mustach_itf itf = {
+    .start = NULL,
+    .put = NULL,
+    .enter = enter,
+    .next = next,
+    .leave = leave,
+    .partial = partial,
+    .emit = emit,
+    .get = get,
+    .stop = NULL,
+};
+
+// Every template under TEMPLATE_DIR, loaded and compiled once at startup. Read-only afterwards,
+// so workers share it without locking.
+typedef struct {
+  template_t *templates;
+  uint32_t num_templates;
+  uint32_t *slots; // open addressing into templates, UINT32_MAX if empty
+  uint32_t num_slots;
+} template_store_t;
+
+static template_store_t g_store;
+
+static uint32_t store_find_slot(const char *name, uint64_t hash) {
+  uint32_t slot = hash & (g_store.num_slots - 1);
+  while (g_store.slots[slot] != UINT32_MAX) {
+    const template_t *tmpl = &g_store.templates[g_store.slots[slot]];
+    if (tmpl->hash == hash && strcmp(tmpl->name, name) == 0) {
+      break;
     }
-    PANIC_ERRNO("Failed to make directory: %s", path);
+    slot = (slot + 1) & (g_store.num_slots - 1);
+  }
+  return slot;
+}
+
+static template_t *store_get(const char *name) {
+  if (g_store.num_slots == 0) {
+    return NULL;
   }
+  uint32_t slot = store_find_slot(name, hash_bytes(name, strlen(name)));
+  return g_store.slots[slot] == UINT32_MAX ? NULL : &g_store.templates[g_store.slots[slot]];
 }
 
-void copy_files(char *fromdir, char *todir) {
-  DIR *dirp = opendir(fromdir);
+const template_t *template_get(const char *name) { return store_get(name); }
+
+void templates_load(const char *dir) {
+  uint64_t start = prof_begin();
+  check_symbols();
+  DIR *dirp = opendir(dir);
   if (dirp == NULL) {
-    PANIC_ERRNO("Failed to open directory: %s", fromdir);
+    PANIC_ERRNO("Failed to open template directory %s", dir);
   }
+  uint32_t capacity = 16;
+  g_store.templates = malloc_panic(capacity * sizeof(template_t));
+  g_store.num_templates = 0;
   struct dirent *ep;
   while ((ep = readdir(dirp)) != NULL) {
-    if (strcmp(".", ep->d_name) == 0 || strcmp("..", ep->d_name) == 0) {
+    size_t name_len = strlen(ep->d_name);
+    size_t ext_len = strlen(TEMPLATE_EXT);
+    if (name_len <= ext_len || strcmp(ep->d_name + name_len - ext_len, TEMPLATE_EXT) != 0) {
       continue;
     }
-    char static_pathname[MAX_PATH_LEN];
-    int s = snprintf(static_pathname, MAX_PATH_LEN, "%s/%s", fromdir, ep->d_name);
-    if (s < 0) {
-      PANIC_ERRNO("Failed to construct static file path");
-    } else if (s >= MAX_PATH_LEN) {
-      PANIC("Failed to construct static file path: length exceeded (%d >= %d)", s, MAX_PATH_LEN);
+    char path[MAX_PATH_LEN];
+    int s = snprintf(path, sizeof(path), "%s/%s", dir, ep->d_name);
+    if (s < 0 || s >= MAX_PATH_LEN) {
+      PANIC("Failed to construct template path for %s", ep->d_name);
     }
-    switch (ep->d_type) {
-    case DT_UNKNOWN: {
-      struct stat statbuf;
-      lstat(static_pathname, &statbuf);
-      if (S_ISREG(statbuf.st_mode)) {
-        goto not_regular;
+    if (g_store.num_templates == capacity) {
+      capacity *= 2;
+      g_store.templates = realloc(g_store.templates, capacity * sizeof(template_t));
+      if (g_store.templates == NULL) {
+        PANIC("Failed to allocate memory");
       }
-    } break;
-    case DT_REG: // regular file
-      break;
-    default:
-    not_regular:
-      // skip file if not regular
-      continue;
     }
-    FILE *static_fp = fopen(static_pathname, "r");
-    if (static_fp == NULL) {
-      printf("Skipping file %s: failed to open: %s\n", static_pathname, strerror(errno));
-      continue;
+    template_t *tmpl = &g_store.templates[g_store.num_templates++];
+    tmpl->name = malloc_panic(name_len - ext_len + 1);
+    memcpy(tmpl->name, ep->d_name, name_len - ext_len);
+    tmpl->name[name_len - ext_len] = '\0';
+    tmpl->hash = hash_bytes(tmpl->name, name_len - ext_len);
+    tmpl->source = read_file(path);
+    tmpl->prog = NULL;
+    tmpl->lists_posts = false;
+  }
+  closedir(dirp);
+
+  g_store.num_slots = 16;
+  while (g_store.num_slots < 2 * g_store.num_templates) {
+    g_store.num_slots *= 2;
+  }
+  g_store.slots = malloc_panic(g_store.num_slots * sizeof(uint32_t));
+  memset(g_store.slots, 0xff, g_store.num_slots * sizeof(uint32_t));
+  for (uint32_t i = 0; i < g_store.num_templates; ++i) {
+    g_store.slots[store_find_slot(g_store.templates[i].name, g_store.templates[i].hash)] = i;
+  }
+
+  // compile once every partial is in the store
+  uint32_t num_errors = 0;
+  for (uint32_t i = 0; i < g_store.num_templates; ++i) {
+    template_t *tmpl = &g_store.templates[i];
+    int status = mustach_compile(tmpl->source.data, tmpl->source.length, &itf, NULL,
+                                 Mustach_With_NoExtensions, &tmpl->prog);
+    if (status == MUSTACH_ERROR_NOT_COMPILABLE) {
+      printf("Template %s will be interpreted: its whitespace depends on the data\n", tmpl->name);
+    } else if (status < 0) {
+      fprintf(stderr, "Failed to compile template %s: %d\n", tmpl->name, status);
+      ++num_errors;
     }
-    char output_pathname[MAX_PATH_LEN];
-    s = snprintf(output_pathname, MAX_PATH_LEN, "%s/%s", todir, ep->d_name);
-    if (s < 0) {
-      PANIC_ERRNO("Failed to construct output file path");
-    } else if (s >= MAX_PATH_LEN) {
-      PANIC("Failed to construct output file path: length exceeded (%d >= %d)", s, MAX_PATH_LEN);
+  }
+  if (num_errors > 0) {
+    PANIC("%u template(s) in %s failed to compile", num_errors, dir);
+  }
+  prof_end("templates", "load", start);
+}
+
+static void render_to_buffer(closure_t *closure, const template_t *tmpl, const char *what) {
+  strbuf_reset(&closure->out);
+  int status;
+  if (tmpl->prog != NULL) {
+    status = mustach_prog_file(tmpl->prog, &itf, closure, NULL);
+  } else {
+    status = mustach_file(tmpl->source.data, tmpl->source.length, &itf, closure,
+                          Mustach_With_NoExtensions, NULL);
+  }
+  if (status == -1) {
+    PANIC_ERRNO("Failed to render template %*s to %s", (int)tmpl->source.length,
+                tmpl->source.data, what);
+  } else if (status < -1) {
+    PANIC("Failed to render template: %d", status);
+  }
+}
+
+void templates_check(const meta_t *meta) {
+  const char *required[] = {"rss", "post", "tag"};
+  uint32_t num_missing = 0;
+  for (size_t i = 0; i < arrlen(required); ++i) {
+    if (template_get(required[i]) == NULL) {
+      fprintf(stderr, "Missing template " TEMPLATE_DIR "/%s" TEMPLATE_EXT "\n", required[i]);
+      ++num_missing;
     }
-    FILE *output_fp = fopen(output_pathname, "w+");
-    if (output_fp == NULL) {
-      printf("Skipping file %s: failed to open: %s\n", output_pathname, strerror(errno));
-      fclose(static_fp);
-      continue;
+  }
+  for (uint32_t i = 0; i < meta->num_pages; ++i) {
+    if (template_get(meta->pages[i]) == NULL) {
+      fprintf(stderr, "Missing template " TEMPLATE_DIR "/%s" TEMPLATE_EXT " for page %s\n",
+              meta->pages[i], meta->pages[i]);
+      ++num_missing;
     }
-    printf("  %s => %s\n", static_pathname, output_pathname);
-    while (!feof(static_fp)) {
-      char buffer[4096];
-      size_t bytes_read = fread(buffer, 1, sizeof(buffer), static_fp);
-      if (bytes_read < sizeof(buffer) && ferror(static_fp)) {
-        PANIC("Failed to read from file %s", static_pathname);
-      }
-      size_t bytes_written = fwrite(buffer, bytes_read, 1, output_fp);
-      if (bytes_written < bytes_read && ferror(output_fp)) {
-        PANIC("Failed to write to file %s", output_pathname);
+  }
+  if (num_missing > 0) {
+    PANIC("%u template(s) missing", num_missing);
+  }
+  if (meta->per_page == 0) {
+    return;
+  }
+
+  // a dry run of every listing tells which templates iterate posts and so get paginated
+  closure_t probe = {.meta = (meta_t *)meta, .probe = true};
+  for (uint32_t i = 0; i < meta->num_pages; ++i) {
+    template_t *tmpl = store_get(meta->pages[i]);
+    probe.state = probe.listing = ROOT;
+    probe.listed = false;
+    render_to_buffer(&probe, tmpl, meta->pages[i]);
+    tmpl->lists_posts = probe.listed;
+  }
+  if (meta->num_tags > 0) {
+    template_t *tmpl = store_get("tag");
+    probe.state = probe.listing = TAG;
+    probe.listed = false;
+    render_to_buffer(&probe, tmpl, "tag");
+    tmpl->lists_posts = probe.listed;
+  }
+  strbuf_free(&probe.out);
+}
+
+uint32_t listing_num_pages(const template_t *tmpl, const meta_t *meta, uint32_t num_posts) {
+  if (meta->per_page == 0 || !tmpl->lists_posts) {
+    return 0;
+  }
+  return num_posts > 0 ? (num_posts - 1) / meta->per_page + 1 : 1;
+}
+
+void templates_free(void) {
+  for (uint32_t i = 0; i < g_store.num_templates; ++i) {
+    mustach_prog_free(g_store.templates[i].prog);
+    free(g_store.templates[i].source.data);
+    free(g_store.templates[i].name);
+  }
+  free(g_store.templates);
+  free(g_store.slots);
+  g_store = (template_store_t){0};
+}
+
+void render_file(closure_t *closure, const template_t *tmpl, char *slug_out, char *ext) {
+  char path[MAX_PATH_LEN];
+  snprintf(path, sizeof(path), OUTPUT_DIR "/%s.%s", slug_out, ext);
+  uint64_t page_start = prof_begin();
+
+  uint64_t start = prof_begin();
+  render_to_buffer(closure, tmpl, slug_out);
+  prof_end("output", "mustach", start);
+  if (minify_enabled() && strcmp(ext, "html") == 0) {
+    start = prof_begin();
+    closure->out.length = minify(MINIFY_HTML, closure->out.data, closure->out.length);
+    closure->out.data[closure->out.length] = '\0';
+    prof_end("output", "minify", start);
+  }
+
+  start = prof_begin();
+  // one hash tells both whether the page and whether its compressed siblings changed
+  uint64_t hash = hash_bytes(closure->out.data, closure->out.length);
+  output_write(path, closure->out.data, closure->out.length, hash);
+  prof_end("output", "write", start);
+  if (compress_enabled()) {
+    start = prof_begin();
+    compress_output(path, closure->out.data, closure->out.length, hash);
+    prof_end("output", "compress", start);
+  }
+  prof_end("page", path, page_start);
+}
+
+char *render_string(closure_t *closure, const template_t *tmpl, size_t *length) {
+  render_to_buffer(closure, tmpl, "memory");
+  *length = closure->out.length;
+  char *data = malloc_panic(closure->out.length + 1);
+  memcpy(data, closure->out.data, closure->out.length + 1);
+  return data;
+}
+
+void make_output_dir(char *path) {
+  if (mkdir(path, 0777)) {
+    if (errno == EEXIST) {
+      struct stat statbuf;
+      lstat(path, &statbuf);
+      if (!S_ISDIR(statbuf.st_mode)) {
+        PANIC("Non-directory already exists: %s (0%06o)", path, statbuf.st_mode);
       }
+      return;
     }
-    fclose(static_fp);
-    fclose(output_fp);
+    PANIC_ERRNO("Failed to make directory: %s", path);
   }
-  closedir(dirp);
 }
@@ -1,21 +1,59 @@
 #ifndef _SSG_TMPL_H_
 #define _SSG_TMPL_H_
 
+#include <stdbool.h>
+
 #include "meta.h"
 #include "util.h"
 
-typedef enum { ROOT = 0, POST, TAG, POST_TAG, POST_JS, TAG_POST } closure_state_e;
+// PAGER is inside {{#prev}} or {{#next}} of a listing page
+typedef enum { ROOT = 0, POST, TAG, POST_TAG, POST_JS, TAG_POST, PAGER } closure_state_e;
+
+typedef struct {
+  char *name; // file name without TEMPLATE_EXT, unique within the store
+  uint64_t hash;
+  string_t source; // a copy, since compiled templates point into it and the file may be rewritten
+  struct mustach_prog *prog; // NULL if the template can only be interpreted
+  bool lists_posts; // iterates the posts of its listing, found by templates_check
+} template_t;
 
 typedef struct {
   meta_t *meta;
   uint32_t index;
   uint32_t index_inner;
   closure_state_e state;
+  /*
+   * Page `page` of `num_pages` of a paginated listing only iterates posts
+   * [(page - 1) * per_page, page * per_page) of the posts of its listing state: the site's from
+   * ROOT, the tag's from TAG. page is 0 on every other page. Later pages are at <slug>/<page>.
+   */
+  closure_state_e listing;
+  const char *listing_slug; // page 1 is at <listing_slug>.html
+  uint32_t page;
+  uint32_t num_pages;
+  bool probe;  // set by templates_check to only find out whether the listing's posts are entered
+  bool listed; // the result of the probe
+  strbuf_t out; // the page being rendered, reused from page to page
 } closure_t;
 
+/*
+ * Low-memory mode: post content is rendered for every use and freed as soon as it is written out,
+ * instead of being kept on the post until the end of the build, and Markdown is fed to cmark in
+ * chunks. Peak memory then follows the largest post, times the number of workers.
+ */
+extern void low_memory_init(bool enabled);
+extern bool low_memory_enabled(void);
 extern void make_output_dir(char *path);
-extern void copy_files(char *fromdir, char *todir);
-extern string_t read_template(const char *slug);
-extern void render_file(closure_t *closure, string_t tmpl, char *slug_out, char *ext);
+extern void templates_load(const char *dir);
+extern void templates_check(const meta_t *meta);
+extern const template_t *template_get(const char *name);
+extern void templates_free(void);
+// Pages of a listing of num_posts posts rendered with tmpl, 0 if it is not paginated
+extern uint32_t listing_num_pages(const template_t *tmpl, const meta_t *meta, uint32_t num_posts);
+extern void render_file(closure_t *closure, const template_t *tmpl, char *slug_out, char *ext);
+// Appends code as a highlighted <pre><code> block, false if there is no grammar for language
+extern bool highlight_block(strbuf_t *out, const char *language, const char *code, size_t length);
+// Renders into a malloc'd, NUL-terminated buffer
+extern char *render_string(closure_t *closure, const template_t *tmpl, size_t *length);
 
 #endif
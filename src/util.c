@@ -1,6 +1,10 @@
 #include "util.h"
 
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void *malloc_panic(size_t size) {
   void *p = malloc(size);
@@ -10,25 +14,148 @@ void *malloc_panic(size_t size) {
   return p;
 }
 
+file_view_t map_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0) {
+    PANIC_ERRNO("Failed to stat %s", path);
+  }
+  file_view_t view = {.data = empty_string(), .length = statbuf.st_size};
+  if (view.length == 0) {
+    close(fd);
+    return view;
+  }
+  size_t page = sysconf(_SC_PAGESIZE);
+  view.mapped = (view.length / page + 1) * page;
+  void *data;
+  if (view.length % page != 0) {
+    // the rest of the last page reads as zeros, which terminates the view
+    data = mmap(NULL, view.length, PROT_READ, MAP_PRIVATE, fd, 0);
+  } else {
+    // the file fills its last page, so the file goes in front of an anonymous zero page
+    data = mmap(NULL, view.mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED) {
+      data = mmap(data, view.length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    }
+  }
+  if (data == MAP_FAILED) {
+    PANIC_ERRNO("Failed to map %s", path);
+  }
+  close(fd);
+  view.data = data;
+  return view;
+}
+
+void unmap_file(file_view_t *view) {
+  if (view->mapped > 0 && munmap((void *)view->data, view->mapped) != 0) {
+    PANIC_ERRNO("Failed to unmap file");
+  }
+  *view = (file_view_t){.data = empty_string()};
+}
+
+bool write_all(int fd, const void *data, size_t length) {
+  for (size_t written = 0; written < length;) {
+    ssize_t n = write(fd, (const char *)data + written, length - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      errno = n == 0 ? EIO : errno; // n == 0 would otherwise retry forever
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
 string_t read_file(const char *path) {
-  FILE *fp = fopen(path, "r");
-  if (fp == NULL) {
-    PANIC_ERRNO("Failed to open template %s", path);
-  }
-  fseek(fp, 0, SEEK_END);
-  long length = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-  string_t string = {
-      .data = malloc_panic(length + 1),
-      .length = length,
-  };
-  if (fread(string.data, length, 1, fp) == 0 && ferror(fp)) {
-    PANIC_ERRNO("Failed to read template %s", path);
-  }
-  fclose(fp);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat statbuf;
+  if (fd < 0 || fstat(fd, &statbuf) != 0) {
+    PANIC_ERRNO("Failed to open %s", path);
+  }
+  string_t string = {.data = malloc_panic(statbuf.st_size + 1)};
+  while (string.length < (size_t)statbuf.st_size) {
+    ssize_t n = read(fd, string.data + string.length, statbuf.st_size - string.length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      PANIC_ERRNO("Failed to read %s", path);
+    } else if (n == 0) {
+      break; // the file shrank since it was stat'ed
+    }
+    string.length += n;
+  }
+  string.data[string.length] = '\0';
+  close(fd);
   return string;
 }
 
 static char empty = '\0';
 
 char *empty_string(void) { return &empty; }
+
+// FNV-1a
+uint64_t hash_bytes(const void *data, size_t length) {
+  return hash_update(0xcbf29ce484222325, data, length);
+}
+
+uint64_t hash_update(uint64_t hash, const void *data, size_t length) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+void write_json_string(FILE *fp, const char *str) {
+  fputc('"', fp);
+  for (; *str != '\0'; ++str) {
+    if (*str == '"' || *str == '\\') {
+      fprintf(fp, "\\%c", *str);
+    } else if ((unsigned char)*str < 0x20) {
+      fprintf(fp, "\\u%04x", *str);
+    } else {
+      fputc(*str, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+char *strbuf_reserve(strbuf_t *sb, size_t extra) {
+  if (sb->length + extra + 1 > sb->capacity) {
+    size_t capacity = sb->capacity ? sb->capacity : 256;
+    while (capacity < sb->length + extra + 1) {
+      capacity *= 2;
+    }
+    sb->data = realloc(sb->data, capacity);
+    if (sb->data == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    sb->capacity = capacity;
+  }
+  return sb->data + sb->length;
+}
+
+void strbuf_append(strbuf_t *sb, const char *data, size_t length) {
+  memcpy(strbuf_reserve(sb, length), data, length);
+  sb->length += length;
+  sb->data[sb->length] = '\0';
+}
+
+void strbuf_append_str(strbuf_t *sb, const char *str) { strbuf_append(sb, str, strlen(str)); }
+
+void strbuf_reset(strbuf_t *sb) {
+  sb->length = 0;
+  if (sb->data != NULL) {
+    sb->data[0] = '\0';
+  }
+}
+
+void strbuf_free(strbuf_t *sb) {
+  free(sb->data);
+  *sb = (strbuf_t){0};
+}
@@ -2,6 +2,8 @@
 #define _SSG_UTIL_H_
 
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -26,8 +28,39 @@ typedef struct {
   size_t length;
 } string_t;
 
+// Read-only view of a whole file, NUL-terminated. The bytes are the page cache's, not a copy.
+typedef struct {
+  const char *data;
+  size_t length;
+  size_t mapped; // 0 if nothing is mapped, for empty files
+} file_view_t;
+
+// Growable string, NUL-terminated after every append. Keep it around to reuse its memory.
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} strbuf_t;
+
 extern void *malloc_panic(size_t size);
-extern string_t read_file(const char *filename);
+// For one-shot reads. Rewriting the file in place while it is mapped would fault the reader.
+extern file_view_t map_file(const char *path);
+extern void unmap_file(file_view_t *view);
+// Writes all of data, resuming after short writes. On failure errno tells why, EIO if nothing went.
+extern bool write_all(int fd, const void *data, size_t length);
+// A malloc'd, NUL-terminated copy of the file, for contents that are kept while the file may change
+extern string_t read_file(const char *path);
 extern char *empty_string(void);
+extern uint64_t hash_bytes(const void *data, size_t length);
+// Continues hash over more data, so that hash_update(hash_bytes(a), b) == hash_bytes(a + b)
+extern uint64_t hash_update(uint64_t hash, const void *data, size_t length);
+// Writes str as a quoted JSON string
+extern void write_json_string(FILE *fp, const char *str);
+// Makes room for extra bytes (plus the NUL) and returns where they go
+extern char *strbuf_reserve(strbuf_t *sb, size_t extra);
+extern void strbuf_append(strbuf_t *sb, const char *data, size_t length);
+extern void strbuf_append_str(strbuf_t *sb, const char *str);
+extern void strbuf_reset(strbuf_t *sb);
+extern void strbuf_free(strbuf_t *sb);
 
 #endif
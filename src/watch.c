@@ -0,0 +1,398 @@
+#include "watch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asset.h"
+#include "cache.h"
+#include "compress.h"
+#include "conf.h"
+#include "prof.h"
+#include "sync.h"
+#include "util.h"
+
+#define WATCH_DEBOUNCE_MS 50
+
+typedef enum { WATCH_ROOT, WATCH_POSTS, WATCH_TEMPLATES, WATCH_STATIC } watch_kind_e;
+
+typedef struct {
+  int wd;
+  watch_kind_e kind;
+  char *dir;
+  char *outdir;     // only for WATCH_STATIC
+  bool fingerprint; // only for WATCH_STATIC, whether its assets are fingerprinted
+} watch_t;
+
+// Every static subdirectory gets its own watch, so the list grows as directories are created
+typedef struct {
+  int fd;
+  watch_t *watches;
+  size_t num_watches;
+  size_t max_watches;
+} watch_list_t;
+
+typedef struct {
+  bool meta;
+  bool templates;
+  bool assets; // a fingerprinted URL changed, so every page may link it
+  bool *posts; // indexed by post handle
+} dirty_t;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int sig) {
+  (void)sig;
+  g_stop = 1;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+  size_t n = strlen(name), m = strlen(suffix);
+  return n >= m && memcmp(name + n - m, suffix, m) == 0;
+}
+
+// Returns the handle of the post whose slug is name without suffix, or -1 if there is none
+static int64_t find_post(const meta_t *meta, const char *name, const char *suffix) {
+  char slug[NAME_MAX + 1];
+  size_t length = strlen(name) - strlen(suffix);
+  memcpy(slug, name, length);
+  slug[length] = '\0';
+  uint32_t post = meta_post_handle(meta, slug);
+  return post != META_NO_POST ? (int64_t)post : -1;
+}
+
+static char *join_path(const char *dir, const char *name) {
+  char path[MAX_PATH_LEN];
+  int s = snprintf(path, MAX_PATH_LEN, "%s/%s", dir, name);
+  if (s < 0 || s >= MAX_PATH_LEN) {
+    printf("Skipping %s/%s: path too long\n", dir, name);
+    return NULL;
+  }
+  char *copy = malloc_panic(s + 1);
+  memcpy(copy, path, s + 1);
+  return copy;
+}
+
+static char *dup_path(const char *path) {
+  size_t length = strlen(path);
+  char *copy = malloc_panic(length + 1);
+  memcpy(copy, path, length + 1);
+  return copy;
+}
+
+// Takes ownership of dir and outdir
+static void add_watch(watch_list_t *list, watch_kind_e kind, char *dir, char *outdir,
+                      bool fingerprint) {
+  uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM;
+  if (kind == WATCH_STATIC) {
+    mask |= IN_CREATE; // new subdirectories
+  }
+  int wd = inotify_add_watch(list->fd, dir, mask);
+  if (wd < 0) {
+    printf("Not watching %s: %s\n", dir, strerror(errno));
+    free(dir);
+    free(outdir);
+    return;
+  }
+  // a new directory may be walked before the event of its creation arrives
+  for (size_t i = 0; i < list->num_watches; ++i) {
+    if (list->watches[i].wd == wd) {
+      free(dir);
+      free(outdir);
+      return;
+    }
+  }
+  if (list->num_watches == list->max_watches) {
+    list->max_watches = list->max_watches ? 2 * list->max_watches : 16;
+    list->watches = realloc(list->watches, list->max_watches * sizeof(watch_t));
+    if (list->watches == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+  }
+  list->watches[list->num_watches++] = (watch_t){
+      .wd = wd, .kind = kind, .dir = dir, .outdir = outdir, .fingerprint = fingerprint};
+}
+
+// Watches dir and every directory below it, each mirrored to the same path under outdir
+static void add_static_watches(watch_list_t *list, const char *dir, const char *outdir,
+                               bool fingerprint) {
+  add_watch(list, WATCH_STATIC, dup_path(dir), dup_path(outdir), fingerprint);
+  DIR *dirp = opendir(dir);
+  if (dirp == NULL) {
+    return; // add_watch already said why
+  }
+  struct dirent *ep;
+  while ((ep = readdir(dirp)) != NULL) {
+    if (ep->d_name[0] == '.') {
+      continue; // also skips . and ..
+    }
+    char *from = join_path(dir, ep->d_name);
+    if (from == NULL) {
+      continue;
+    }
+    struct stat statbuf;
+    if (stat(from, &statbuf) == 0 && S_ISDIR(statbuf.st_mode)) {
+      char *to = join_path(outdir, ep->d_name);
+      if (to != NULL) {
+        add_static_watches(list, from, to, fingerprint);
+        free(to);
+      }
+    }
+    free(from);
+  }
+  closedir(dirp);
+}
+
+// Drops the watch of wd, which the kernel removed along with its directory
+static void remove_watch(watch_list_t *list, int wd) {
+  for (size_t i = 0; i < list->num_watches; ++i) {
+    if (list->watches[i].wd == wd) {
+      free(list->watches[i].dir);
+      free(list->watches[i].outdir);
+      list->watches[i] = list->watches[--list->num_watches];
+      return;
+    }
+  }
+}
+
+static void handle_static_dir(build_t *build, watch_list_t *list, const watch_t *watch,
+                              const struct inotify_event *event, dirty_t *dirty) {
+  char *from = join_path(watch->dir, event->name);
+  char *to = join_path(watch->outdir, event->name);
+  bool fingerprint = watch->fingerprint;
+  if (from == NULL || to == NULL) {
+    free(from);
+    free(to);
+    return;
+  }
+  if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+    // its files are reported and removed one by one, this only removes the emptied directory
+    rmdir(to);
+  } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+    // watched before copying, so that a file written in between is not missed
+    add_static_watches(list, from, to, fingerprint);
+    copy_files(build->pool, from, to, fingerprint);
+    dirty->assets |= fingerprint && assets_enabled();
+  }
+  free(from);
+  free(to);
+}
+
+static void handle_event(build_t *build, watch_list_t *list, const watch_t *watch,
+                         const struct inotify_event *event, dirty_t *dirty) {
+  const char *name = event->name;
+  if (event->len == 0 || name[0] == '.') {
+    return; // hidden and editor swap files
+  }
+  if (event->mask & IN_ISDIR) {
+    if (watch->kind == WATCH_STATIC) {
+      handle_static_dir(build, list, watch, event, dirty);
+    }
+    return;
+  }
+  if (event->mask & IN_CREATE) {
+    return; // the file is handled once it is written
+  }
+  switch (watch->kind) {
+  case WATCH_ROOT:
+    if (strcmp(name, METADATA_FILE) == 0) {
+      dirty->meta = true;
+    }
+    break;
+  case WATCH_POSTS:
+    if (has_suffix(name, ".md") && !(event->mask & (IN_DELETE | IN_MOVED_FROM))) {
+      int64_t post = find_post(build->meta, name, ".md");
+      if (post >= 0) {
+        dirty->posts[post] = true;
+      }
+    }
+    break;
+  case WATCH_TEMPLATES:
+    if (has_suffix(name, TEMPLATE_EXT) && !(event->mask & (IN_DELETE | IN_MOVED_FROM))) {
+      dirty->templates = true;
+    }
+    break;
+  case WATCH_STATIC: {
+    char from[MAX_PATH_LEN], to[MAX_PATH_LEN];
+    int s = snprintf(from, MAX_PATH_LEN, "%s/%s", watch->dir, name);
+    int t = snprintf(to, MAX_PATH_LEN, "%s/%s", watch->outdir, name);
+    if (s < 0 || s >= MAX_PATH_LEN || t < 0 || t >= MAX_PATH_LEN) {
+      printf("Skipping file %s/%s: path too long\n", watch->dir, name);
+      return;
+    }
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      printf("  removing %s\n", to);
+      unlink(to);
+      compress_remove(to);
+      if (watch->fingerprint && assets_enabled() && asset_wanted(to)) {
+        dirty->assets |= asset_remove(to); // pages link the plain URL again
+      }
+    } else if (copy_file(from, to)) {
+      if (compress_enabled() && compress_wanted(to)) {
+        compress_file(to);
+      }
+      if (watch->fingerprint && assets_enabled() && asset_wanted(to)) {
+        dirty->assets |= fingerprint_file(to);
+      }
+    }
+    // the post template only links a script that exists, so adding or removing one changes the post
+    if (strcmp(watch->dir, STATIC_DIR "/scripts/post") == 0 && has_suffix(name, ".js")) {
+      int64_t post = find_post(build->meta, name, ".js");
+      if (post >= 0) {
+        dirty->posts[post] = true;
+      }
+    }
+  } break;
+  }
+}
+
+// Reads one batch of events, returns false if interrupted
+static bool read_events(build_t *build, watch_list_t *list, dirty_t *dirty) {
+  _Alignas(struct inotify_event) char buf[4096];
+  ssize_t n = read(list->fd, buf, sizeof(buf));
+  if (n < 0) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return errno == EAGAIN;
+    }
+    PANIC_ERRNO("Failed to read inotify events");
+  }
+  for (char *p = buf; p < buf + n;) {
+    const struct inotify_event *event = (const struct inotify_event *)p;
+    if (event->mask & IN_IGNORED) {
+      remove_watch(list, event->wd);
+    } else {
+      // handle_event may add watches, which moves the list, so it gets a copy
+      for (size_t i = 0; i < list->num_watches; ++i) {
+        if (list->watches[i].wd == event->wd) {
+          watch_t watch = list->watches[i];
+          handle_event(build, list, &watch, event, dirty);
+          break;
+        }
+      }
+    }
+    p += sizeof(struct inotify_event) + event->len;
+  }
+  return true;
+}
+
+// Whether any page has to be rendered again, static files are copied as their events come in
+static bool needs_rebuild(const build_t *build, const dirty_t *dirty) {
+  bool posts = false;
+  for (uint32_t i = 0; i < build->meta->num_posts; ++i) {
+    posts |= dirty->posts[i];
+  }
+  return dirty->meta || dirty->templates || dirty->assets || posts;
+}
+
+static void rebuild(build_t *build, dirty_t *dirty) {
+  double start = now_ms();
+  uint64_t prof_start = prof_begin();
+  if (dirty->assets) {
+    assets_write_manifest(ASSET_MANIFEST);
+  }
+  if (dirty->meta) {
+    build_load_meta(build);
+    templates_check(build->meta);
+    build_queue_all(build);
+  } else if (dirty->templates) {
+    printf("RELOADING TEMPLATES FROM " TEMPLATE_DIR "\n");
+    templates_free();
+    templates_load(TEMPLATE_DIR);
+    templates_check(build->meta);
+    build_queue_all(build);
+  } else if (dirty->assets) {
+    build_queue_all(build);
+  } else {
+    for (uint32_t i = 0; i < build->meta->num_posts; ++i) {
+      if (!dirty->posts[i]) {
+        continue;
+      }
+      meta_post_t *post = &build->meta->posts[i];
+      pthread_mutex_lock(&post->lock);
+      free(post->content);
+      post->content = NULL;
+      pthread_mutex_unlock(&post->lock);
+      build_queue_post(build, i);
+      for (uint32_t j = 0; j < post->num_tags; ++j) {
+        build_queue_tag(build, post->tag_handles[j]);
+      }
+      build_queue_listings(build);
+    }
+  }
+  size_t rendered = build_run(build);
+  // the blocks highlighted by this rebuild would otherwise stay in memory until the end
+  code_cache_flush();
+  prof_end("watch", "rebuild", prof_start);
+  if (rendered > 0) {
+    printf("REBUILT %zu outputs in %.1f ms\n", rendered, now_ms() - start);
+  }
+  prof_flush();
+}
+
+void watch_run(build_t *build) {
+  watch_list_t list = {.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)};
+  if (list.fd < 0) {
+    PANIC_ERRNO("Failed to initialise inotify");
+  }
+  add_watch(&list, WATCH_ROOT, dup_path("."), NULL, false);
+  add_watch(&list, WATCH_POSTS, dup_path(POSTS_DIR), NULL, false);
+  add_watch(&list, WATCH_TEMPLATES, dup_path(TEMPLATE_DIR), NULL, false);
+  add_static_watches(&list, STATIC_DIR, OUTPUT_DIR, true);
+  add_static_watches(&list, build->wasmdir, OUTPUT_DIR "/wasm", false);
+
+  // no SA_RESTART, so that poll returns and the caches get flushed on the way out
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // each rebuild gets a trace of its own, the first one is the initial build's
+  prof_flush();
+  printf("WATCHING FOR CHANGES (press Ctrl-C to stop)\n");
+  while (!g_stop) {
+    struct pollfd pfd = {.fd = list.fd, .events = POLLIN};
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PANIC_ERRNO("Failed to poll inotify");
+    }
+    // meta may be reparsed by the rebuild, so the dirty posts are sized per round
+    dirty_t dirty = {.posts = calloc(build->meta->num_posts + 1, sizeof(bool))};
+    if (dirty.posts == NULL) {
+      PANIC("Failed to allocate memory");
+    }
+    // editors tend to write a file in several steps, so wait until the events settle
+    do {
+      if (!read_events(build, &list, &dirty)) {
+        break;
+      }
+    } while (!g_stop && poll(&pfd, 1, WATCH_DEBOUNCE_MS) > 0);
+    // also skips the events of unrelated files, like a profile trace written into the site
+    if (!g_stop && needs_rebuild(build, &dirty)) {
+      rebuild(build, &dirty);
+    }
+    free(dirty.posts);
+  }
+  printf("STOPPING WATCH\n");
+  for (size_t i = 0; i < list.num_watches; ++i) {
+    free(list.watches[i].dir);
+    free(list.watches[i].outdir);
+  }
+  free(list.watches);
+  close(list.fd);
+}
@@ -0,0 +1,9 @@
+#ifndef _SSG_WATCH_H_
+#define _SSG_WATCH_H_
+
+#include "build.h"
+
+// Watches the site sources with inotify and rebuilds what changed until interrupted.
+extern void watch_run(build_t *build);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * Checks of the kernels whose output has to match a simpler reference exactly, linked against the
+ * sausage sources like the microbenchmarks. Prints every failed check and exits non-zero if any.
+ */
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cache.h"
+#include "../src/conf.h"
+#include "../src/meta.h"
+#include "../src/minify.h"
+#include "../src/tmpl.h"
+#include "../src/util.h"
+
+#ifndef TEST_TEMPLATE_DIR
+#define TEST_TEMPLATE_DIR "templates"
+#endif
+
+static uint32_t g_checks = 0;
+static uint32_t g_failures = 0;
+
+#define CHECK(cond, ...)                                                                           \
+  do {                                                                                             \
+    ++g_checks;                                                                                    \
+    if (!(cond)) {                                                                                 \
+      ++g_failures;                                                                                \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);                                              \
+      fprintf(stderr, __VA_ARGS__);                                                                \
+      fprintf(stderr, "\n");                                                                       \
+    }                                                                                              \
+  } while (0)
+
+// Posts with and without tags, so that sections are both shown and skipped, and more posts than
+// per_page, so that listings have several pages
+static const char g_site_toml[] = "site_name = \"Site & <name>\"\n"
+                                  "site_url = \"https://example.com\"\n"
+                                  "site_desc = \"Description\"\n"
+                                  "pages = [ \"index\", \"about\", \"blog\" ]\n"
+                                  "per_page = 2\n"
+                                  "[post.first]\n"
+                                  "title = \"First <post>\"\n"
+                                  "tags = [ \"c\", \"rust\" ]\n"
+                                  "date = 2024-01-03\n"
+                                  "[post.second]\n"
+                                  "title = \"Second\"\n"
+                                  "desc = \"With a description\"\n"
+                                  "tags = [ \"c\" ]\n"
+                                  "date = 2024-01-02\n"
+                                  "[post.third]\n"
+                                  "title = \"Third\"\n"
+                                  "tags = [ ]\n"
+                                  "date = 2024-01-01\n"
+                                  "[post.fourth]\n"
+                                  "title = \"Fourth\"\n"
+                                  "tags = [ \"c\" ]\n"
+                                  "date = 2023-12-31\n"
+                                  "[post.fifth]\n"
+                                  "title = \"Fifth\"\n"
+                                  "tags = [ \"c\", \"misc\" ]\n"
+                                  "date = 2023-12-30\n";
+
+static meta_t *site_meta(void) {
+  char toml[sizeof(g_site_toml)];
+  memcpy(toml, g_site_toml, sizeof(g_site_toml));
+  char errbuf[256];
+  toml_table_t *table = toml_parse(toml, errbuf, sizeof(errbuf));
+  if (table == NULL) {
+    PANIC("Failed to parse the test sausage.toml: %s", errbuf);
+  }
+  meta_t *meta = meta_render(table);
+  toml_free(table);
+  // stands in for rendered Markdown, so that no post file is read
+  for (uint32_t i = 0; i < meta->num_posts; ++i) {
+    static const char content[] = "<p>Content &amp; more</p>\n";
+    meta->posts[i].content = malloc_panic(sizeof(content));
+    memcpy(meta->posts[i].content, content, sizeof(content));
+  }
+  return meta;
+}
+
+// Renders tmpl compiled and interpreted, as mustach_file runs it, and compares the pages
+static void check_render(const char *name, closure_t *closure) {
+  const template_t *tmpl = template_get(name);
+  template_t interpreted = *tmpl;
+  interpreted.prog = NULL;
+  size_t compiled_length, interpreted_length;
+  closure_t start = *closure;
+  char *compiled = render_string(closure, tmpl, &compiled_length);
+  *closure = start;
+  char *expected = render_string(closure, &interpreted, &interpreted_length);
+  CHECK(compiled_length == interpreted_length && memcmp(compiled, expected, compiled_length) == 0,
+        "template %s (state %d, index %u, page %u) renders differently once compiled:\n"
+        "--- compiled\n%s\n--- interpreted\n%s",
+        name, closure->state, closure->index, closure->page, compiled, expected);
+  free(compiled);
+  free(expected);
+}
+
+// Renders name in every state the build renders it in
+static void check_template(const char *name, meta_t *meta, bool must_compile) {
+  const template_t *tmpl = template_get(name);
+  if (must_compile) {
+    CHECK(tmpl->prog != NULL, "template %s is not compiled", name);
+  }
+  closure_t closure = {.meta = meta};
+  if (strcmp(name, "post") == 0) {
+    for (uint32_t i = 0; i < meta->num_posts; ++i) {
+      closure.state = closure.listing = POST;
+      closure.index = i;
+      check_render(name, &closure);
+    }
+  } else if (strcmp(name, "tag") == 0) {
+    for (uint32_t i = 0; i < meta->num_tags; ++i) {
+      closure.state = closure.listing = TAG;
+      closure.index = i;
+      closure.listing_slug = meta->tags[i].id;
+      closure.num_pages = listing_num_pages(tmpl, meta, meta->tags[i].num_posts);
+      for (closure.page = closure.num_pages > 0; closure.page <= closure.num_pages;
+           ++closure.page) {
+        check_render(name, &closure);
+      }
+    }
+  } else {
+    closure.state = closure.listing = ROOT;
+    closure.listing_slug = name;
+    closure.num_pages = listing_num_pages(tmpl, meta, meta->num_posts);
+    for (closure.page = closure.num_pages > 0; closure.page <= closure.num_pages; ++closure.page) {
+      check_render(name, &closure);
+    }
+  }
+  strbuf_free(&closure.out);
+}
+
+// Checks every template of dir, all of which must compile if must_compile
+static void check_template_dir(const char *dir, bool must_compile) {
+  meta_t *meta = site_meta();
+  templates_load(dir);
+  templates_check(meta);
+  DIR *dirp = opendir(dir);
+  if (dirp == NULL) {
+    PANIC_ERRNO("Failed to open template directory %s", dir);
+  }
+  struct dirent *ep;
+  while ((ep = readdir(dirp)) != NULL) {
+    size_t length = strlen(ep->d_name), ext_length = strlen(TEMPLATE_EXT);
+    if (length > ext_length && strcmp(ep->d_name + length - ext_length, TEMPLATE_EXT) == 0) {
+      ep->d_name[length - ext_length] = '\0';
+      check_template(ep->d_name, meta, must_compile);
+    }
+  }
+  closedir(dirp);
+  templates_free();
+  meta_free(meta);
+}
+
+static void write_template(const char *dir, const char *name, const char *source) {
+  char path[MAX_PATH_LEN];
+  snprintf(path, sizeof(path), "%s/%s" TEMPLATE_EXT, dir, name);
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL || fputs(source, fp) < 0 || fclose(fp) != 0) {
+    PANIC_ERRNO("Failed to write %s", path);
+  }
+}
+
+// Every template the repo ships compiles and renders exactly as the interpreter does
+static void test_repo_templates(void) { check_template_dir(TEST_TEMPLATE_DIR, true); }
+
+/*
+ * Sections at every position on a line, shown, skipped and looping, at the top level and in an
+ * indented partial, against the interpreter. These all compile.
+ */
+static void test_template_whitespace(void) {
+  char dir[] = "/tmp/sausage-test-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    PANIC_ERRNO("Failed to make a temporary directory");
+  }
+  static const char shapes[] =
+      "  {{#posts}}<a>{{title}}</a>{{/posts}}\n"
+      "  {{#posts}}<li>\n"
+      "  {{/posts}}\n"
+      "  {{^posts}}none{{/posts}}\n"
+      "  {{#tags}}{{id}} {{/tags}}x\n"
+      "\t{{#posts}}{{#tags}}<b>{{id}}</b>{{/tags}}{{/posts}}\n"
+      "  {{#posts}}  {{#tags}} {{id}}{{/tags}}  {{/posts}}\n"
+      "  {{#posts}}{{title}}{{/posts}}  \n"
+      "{{#posts}}\n"
+      "  {{#tags}}<a href=\"/tag/{{id}}.html\">#{{id}}</a>{{/tags}}\n"
+      "{{/posts}}\n"
+      "  {{#prev}}<a href=\"{{prev}}\">newer</a>{{/prev}} {{#next}}<a href=\"{{next}}\">older</a>"
+      "{{/next}}\n"
+      "<p>{{#posts}}{{title}}, {{/posts}}</p>\n"
+      "  {{#posts}}\n"
+      "  <li>{{title}}</li>\n"
+      "  {{/posts}}\n";
+  write_template(dir, "shapes", shapes);
+  write_template(dir, "blog", shapes);
+  write_template(dir, "index", "<main>\n    {{>shapes}}\n  {{>shapes}}</main>\n");
+  write_template(dir, "about", "{{<index}}{{/index}}\n");
+  write_template(dir, "rss", "{{#posts}}{{title}}{{/posts}}\n");
+  write_template(dir, "post", "  {{#tags}}<a>{{id}}</a>{{/tags}}\n  {{#js}}<s>{{/js}}\n");
+  write_template(dir, "tag", "<ul>\n  {{#posts}}<li>{{title}}</li>{{/posts}}\n</ul>\n"
+                             "  {{#prev}}<a href=\"{{prev}}\">newer</a>{{/prev}}\n"
+                             "  {{#next}}<a href=\"{{next}}\">older</a>{{/next}}\n");
+  check_template_dir(dir, true);
+
+  DIR *dirp = opendir(dir);
+  struct dirent *ep;
+  while (dirp != NULL && (ep = readdir(dirp)) != NULL) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", dir, ep->d_name);
+    unlink(path);
+  }
+  if (dirp != NULL) {
+    closedir(dirp);
+  }
+  rmdir(dir);
+}
+
+// Every post and tag is found by its slug or id, and nothing else is
+static void test_meta_index(void) {
+  meta_t *meta = site_meta();
+  for (uint32_t i = 0; i < meta->num_posts; ++i) {
+    CHECK(meta_post_handle(meta, meta->posts[i].slug) == i, "post %s is not found",
+          meta->posts[i].slug);
+  }
+  for (uint32_t i = 0; i < meta->num_tags; ++i) {
+    CHECK(meta_tag_handle(meta, meta->tags[i].id) == i, "tag %s is not found", meta->tags[i].id);
+  }
+  CHECK(meta_post_handle(meta, "sixth") == META_NO_POST, "post sixth is found");
+  CHECK(meta_post_handle(meta, "") == META_NO_POST, "the empty slug is found");
+  CHECK(meta_tag_handle(meta, "go") == META_NO_TAG, "tag go is found");
+  meta_free(meta);
+}
+
+static void check_minify(const char *html, const char *expected) {
+  char data[256];
+  size_t length = strlen(html);
+  memcpy(data, html, length);
+  length = minify(MINIFY_HTML, data, length);
+  CHECK(length == strlen(expected) && memcmp(data, expected, length) == 0,
+        "minified %s into %.*s, not %s", html, (int)length, data, expected);
+}
+
+// pre, code and textarea come out byte for byte, comments and tags in them included
+static void test_minify_verbatim(void) {
+  check_minify("<pre>&lt;!-- x --&gt; <!-- y --></pre>", "<pre>&lt;!-- x --&gt; <!-- y --></pre>");
+  check_minify("<pre>  a\n  <b  class=\"x\">b</b> <!-- \"c -->\n</pre>",
+               "<pre>  a\n  <b  class=\"x\">b</b> <!-- \"c -->\n</pre>");
+  check_minify("<p>a  <code>x  <!-- y -->  z</code>  b</p>",
+               "<p>a <code>x  <!-- y -->  z</code> b</p>");
+  check_minify("<textarea>  <!--  --> </textarea>", "<textarea>  <!--  --> </textarea>");
+  check_minify("<pre>a</pre>  <!-- x -->  <p>b</p>", "<pre>a</pre> <p>b</p>");
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  cache_init(NULL);
+  test_repo_templates();
+  test_template_whitespace();
+  test_minify_verbatim();
+  test_meta_index();
+  printf("%u checks, %u failed\n", g_checks, g_failures);
+  return g_failures > 0;
+}